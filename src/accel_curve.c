@@ -0,0 +1,192 @@
+/*
+*	accel_curve.c
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#include "accel_curve.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+static int32_t points = 0;
+static double speed[ACCEL_CURVE_MAX_POINTS];
+static double acc[ACCEL_CURVE_MAX_POINTS];
+
+int8_t accel_curve_load(const char *path)
+{
+	FILE *fp;
+	char line[256];
+	int32_t line_no = 0;
+
+	if((fp = fopen(path, "r")) == NULL)
+	{
+		perror("\nERROR: Could not open acceleration curve");
+		return -1;
+	}
+
+	points = 0;
+
+	while(fgets(line, sizeof(line), fp) != NULL)
+	{
+		double s;
+		double a;
+		char *p = line;
+
+		line_no++;
+		p += strspn(p, " \t");
+
+		if(*p == '#' || *p == '\n' || *p == '\r' || *p == 0)
+		{
+			continue;
+		}
+
+		if(sscanf(p, "%lf%*[ \t,]%lf", &s, &a) != 2 || s < 0 || a <= 0)
+		{
+			fprintf(stderr, "\nERROR: %s line %d: expected \"speed acceleration\" with a positive acceleration\n", path, line_no);
+			fclose(fp);
+			points = 0;
+			return -1;
+		}
+
+		if(points == ACCEL_CURVE_MAX_POINTS)
+		{
+			fprintf(stderr, "\nERROR: %s has more than %d points\n", path, ACCEL_CURVE_MAX_POINTS);
+			fclose(fp);
+			points = 0;
+			return -1;
+		}
+
+		if(points > 0 && s <= speed[points - 1])
+		{
+			fprintf(stderr, "\nERROR: %s line %d: speeds must increase\n", path, line_no);
+			fclose(fp);
+			points = 0;
+			return -1;
+		}
+
+		speed[points] = s;
+		acc[points] = a;
+		points++;
+	}
+
+	fclose(fp);
+
+	if(points == 0)
+	{
+		fprintf(stderr, "\nERROR: %s has no points\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+_Bool accel_curve_active(void)
+{
+	return points > 0;
+}
+
+double accel_curve_limit(const double v, const double cap)
+{
+	double a;
+
+	if(points == 0)
+	{
+		return cap;
+	}
+
+	if(v <= speed[0])
+	{
+		a = acc[0];
+	}
+	else if(v >= speed[points - 1])
+	{
+		a = acc[points - 1];
+	}
+	else
+	{
+		/* tables are small, a linear search is fine - even in the pulse loop, which only needs it off the planned ramps */
+		int32_t i = 1;
+
+		while(speed[i] < v)
+		{
+			i++;
+		}
+
+		a = acc[i - 1] + ((acc[i] - acc[i - 1]) * (v - speed[i - 1]) / (speed[i] - speed[i - 1]));
+	}
+
+	return (a < cap) ? a : cap;
+}
+
+double accel_curve_min(const double v0, const double v1, const double cap)
+{
+	double lo = (v0 < v1) ? v0 : v1;
+	double hi = (v0 < v1) ? v1 : v0;
+	double a = accel_curve_limit(lo, cap);
+	double b = accel_curve_limit(hi, cap);
+
+	/* linear between the points, so the lowest value is at an end or at a point in between */
+	a = (b < a) ? b : a;
+
+	for(int32_t i = 0; i < points; i++)
+	{
+		if(speed[i] > lo && speed[i] < hi && acc[i] < a)
+		{
+			a = acc[i];
+		}
+	}
+
+	return (a < cap) ? a : cap;
+}
+
+double accel_curve_distance(const double v0, const double v1, const double cap)
+{
+	double lo = (v0 < v1) ? v0 : v1;
+	double hi = (v0 < v1) ? v1 : v0;
+
+	if(points == 0)
+	{
+		return ((hi * hi) - (lo * lo)) / (2.0 * cap);
+	}
+
+	/**
+	 * the distance is the integral of v / a(v) dv. v / a(v) is convex where the curve falls with speed, so the
+	 * trapezoid rule errs long there - a stop worked out with it has room to spare rather than too little
+	 **/
+	double dv = (hi - lo) / ACCEL_CURVE_DISTANCE_SLICES;
+	double prev = lo / accel_curve_limit(lo, cap);
+	double d = 0;
+
+	for(int32_t i = 1; i <= ACCEL_CURVE_DISTANCE_SLICES; i++)
+	{
+		double v = lo + (i * dv);
+		double next = v / accel_curve_limit(v, cap);
+
+		d += (prev + next) * dv / 2.0;
+		prev = next;
+	}
+
+	return d;
+}
+
+uint64_t accel_curve_fingerprint(void)
+{
+	/* FNV-1a over the points */
+	uint64_t h = 14695981039346656037ULL;
+	const uint8_t *p[2] = {(const uint8_t *)speed, (const uint8_t *)acc};
+
+	for(int32_t k = 0; k < 2; k++)
+	{
+		for(size_t i = 0; i < points * sizeof(double); i++)
+		{
+			h = (h ^ p[k][i]) * 1099511628211ULL;
+		}
+	}
+
+	return (points == 0) ? 0 : h;
+}
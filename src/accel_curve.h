@@ -0,0 +1,54 @@
+/*
+*	accel_curve.h
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#ifndef ACCEL_CURVE_H
+#define ACCEL_CURVE_H
+
+#include <stdint.h>
+
+#define ACCEL_CURVE_MAX_POINTS 64
+
+/* slices accel_curve_distance() integrates over */
+#define ACCEL_CURVE_DISTANCE_SLICES 32
+
+/**
+ * ACCELERATION VS SPEED CURVE
+ * Steppers lose torque as they speed up, so the safe acceleration depends on speed. Loaded with -T from a text file
+ * with one "speed acceleration" pair per line (steps/s, steps/s^2), in increasing speed order. Blank lines and lines
+ * starting with # are skipped, and the two values may also be separated by a comma:
+ *
+ *	# speed	acc
+ *	0		60000
+ *	5000	40000
+ *	15000	12000
+ *
+ * Between points the acceleration is interpolated linearly, outside the table the closest point is used.
+ * The same curve limits deceleration. -a and -d still apply as upper limits.
+ * The planned ramps follow the curve, and so does the pulse loop wherever it leaves the plan: a feed override change,
+ * a re-planned deceleration, a stop, a jog or a following axis.
+ **/
+
+/* loads the curve. returns 0 on success, -1 on failure (the error is printed) */
+int8_t accel_curve_load(const char *path);
+
+/* 1 if a curve was loaded */
+_Bool accel_curve_active(void);
+
+/* the acceleration limit at speed v, capped at cap. without a curve this is just cap */
+double accel_curve_limit(const double v, const double cap);
+
+/* the lowest acceleration limit anywhere between speeds v0 and v1, capped at cap */
+double accel_curve_min(const double v0, const double v1, const double cap);
+
+/* the steps it takes to change speed between v0 and v1 at the limit of the curve, capped at cap. without a curve this is (v1^2 - v0^2) / 2cap */
+double accel_curve_distance(const double v0, const double v1, const double cap);
+
+/* identifies the loaded curve, so plans made with a different curve can be told apart (see plan_cache.h). 0 without a curve */
+uint64_t accel_curve_fingerprint(void);
+
+#endif /*ACCEL_CURVE_H*/
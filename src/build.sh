@@ -1,4 +1,12 @@
 #!/bin/bash
 
 clear
-gcc -Wall -lrt -lwiringPi -lm -lbsd globals.c motion_control.c pulse_train.c debounce.c main.c -g
+gcc -Wall -lrt -lwiringPi -lm -lbsd -lpthread globals.c motion_control.c pulse_train.c debounce.c encoder.c telemetry.c trace.c feed_override.c stop_request.c planner.c accel_curve.c plan_cache.c timebase.c position.c homing.c jog.c resonance.c gearing.c perf_counters.c state_machine.c watchdog.c replay.c rt_sched.c main.c -g
+gcc -Wall -fPIC -shared -lrt -lwiringPi -lm -lbsd -lpthread globals.c motion_control.c pulse_train.c debounce.c encoder.c telemetry.c trace.c feed_override.c stop_request.c planner.c accel_curve.c plan_cache.c timebase.c position.c homing.c jog.c resonance.c gearing.c perf_counters.c state_machine.c watchdog.c replay.c rhubarb.c -o librhubarb.so -g
+gcc -Wall -lrt -lwiringPi -lm -lbsd -lpthread globals.c motion_control.c pulse_train.c debounce.c encoder.c telemetry.c trace.c feed_override.c stop_request.c planner.c accel_curve.c plan_cache.c timebase.c position.c homing.c jog.c resonance.c gearing.c perf_counters.c state_machine.c watchdog.c replay.c estimate.c -o rhubarb_estimate -g
+gcc -Wall -lrt -lwiringPi -lm -lbsd -lpthread globals.c motion_control.c pulse_train.c debounce.c encoder.c telemetry.c trace.c feed_override.c stop_request.c planner.c accel_curve.c plan_cache.c timebase.c position.c homing.c jog.c resonance.c gearing.c perf_counters.c state_machine.c watchdog.c replay.c verify.c -o rhubarb_verify -g
+gcc -Wall trace_convert.c -o rhubarb_trace -g
+
+if [ "$1" == "test" ]; then
+	../tests/run.sh
+fi
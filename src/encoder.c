@@ -0,0 +1,171 @@
+/*
+*	encoder.c
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#include "encoder.h"
+#include "globals.h"
+#include "motion_control.h"
+
+#include <wiringPi.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+extern int8_t WIRINGPI_ENCODER_A_INPUT;
+extern int8_t WIRINGPI_ENCODER_B_INPUT;
+extern int32_t ENCODER_COUNTS_PER_REV;
+extern int32_t FOLLOWING_ERROR_LIMIT;
+
+/* 1ms between following error checks - well below the time a stalled motor needs to lose a meaningful number of steps */
+#define ENCODER_MONITOR_PERIOD_NS 1000000
+
+/* the monitor runs below the pulse loop (85) but above wiringPi's interrupt threads (55) */
+#define ENCODER_MONITOR_PRIORITY 80
+
+static pthread_mutex_t decode_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t monitor_thread;
+static uint8_t last_ab = 0;
+
+static int64_t enc_pos = 0;
+static int64_t following_error = 0;
+static volatile _Bool fault = false;
+
+static const uint64_t *tracked_pos = NULL;
+static int8_t tracked_dir = 1;
+static int32_t tracked_steps_per_rev = 0;
+
+static uint8_t _read_ab(void);
+static void _encoder_isr(void);
+static void *_encoder_monitor(void *arg);
+
+int8_t encoder_init(void)
+{
+	pinMode(WIRINGPI_ENCODER_A_INPUT, INPUT);
+	pinMode(WIRINGPI_ENCODER_B_INPUT, INPUT);
+	pullUpDnControl(WIRINGPI_ENCODER_A_INPUT, PUD_UP);
+	pullUpDnControl(WIRINGPI_ENCODER_B_INPUT, PUD_UP);
+
+	last_ab = _read_ab();
+
+	/* both channels share one decoder - whichever edge arrives, the full AB state is re-read */
+	if(wiringPiISR(WIRINGPI_ENCODER_A_INPUT, INT_EDGE_BOTH, &_encoder_isr) < 0 || wiringPiISR(WIRINGPI_ENCODER_B_INPUT, INT_EDGE_BOTH, &_encoder_isr) < 0)
+	{
+		fprintf(stderr, "\nERROR: Could not attach encoder interrupts\n");
+		return -1;
+	}
+
+	pthread_attr_t attr;
+	struct sched_param param;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	param.sched_priority = ENCODER_MONITOR_PRIORITY;
+	pthread_attr_setschedparam(&attr, &param);
+
+	if(pthread_create(&monitor_thread, &attr, &_encoder_monitor, NULL) != 0)
+	{
+		pthread_attr_destroy(&attr);
+		fprintf(stderr, "\nERROR: Could not start encoder monitor thread\n");
+		return -1;
+	}
+
+	pthread_attr_destroy(&attr);
+	return 0;
+}
+
+void encoder_track(const uint64_t *commanded_pos, const int8_t direction, const int32_t steps_per_rev)
+{
+	pthread_mutex_lock(&decode_lock);
+	__atomic_store_n(&enc_pos, 0, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&decode_lock);
+
+	fault = false;
+	__atomic_store_n(&following_error, 0, __ATOMIC_RELAXED);
+
+	tracked_dir = direction;
+	tracked_steps_per_rev = steps_per_rev;
+	__atomic_store_n(&tracked_pos, commanded_pos, __ATOMIC_RELEASE);
+}
+
+void encoder_untrack(void)
+{
+	__atomic_store_n(&tracked_pos, NULL, __ATOMIC_RELEASE);
+}
+
+_Bool encoder_fault(void)
+{
+	return fault;
+}
+
+int64_t encoder_position(void)
+{
+	return __atomic_load_n(&enc_pos, __ATOMIC_RELAXED);
+}
+
+int64_t encoder_following_error(void)
+{
+	return __atomic_load_n(&following_error, __ATOMIC_RELAXED);
+}
+
+static uint8_t _read_ab(void)
+{
+	return (uint8_t)((digitalRead(WIRINGPI_ENCODER_A_INPUT) << 1) | digitalRead(WIRINGPI_ENCODER_B_INPUT));
+}
+
+static void _encoder_isr(void)
+{
+	pthread_mutex_lock(&decode_lock);
+
+	uint8_t ab = _read_ab();
+	int8_t delta = encoder_quadrature_delta(last_ab, ab);
+	last_ab = ab;
+
+	if(delta != 0)
+	{
+		__atomic_store_n(&enc_pos, enc_pos + delta, __ATOMIC_RELAXED);
+	}
+
+	pthread_mutex_unlock(&decode_lock);
+}
+
+/**
+ * Periodically compares the commanded position to the encoder position.
+ * Encoder counts are scaled into drive steps, and the sign is flipped for CCW moves since motor_pos always counts up.
+ **/
+static void *_encoder_monitor(void *arg)
+{
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	for(;;)
+	{
+		const uint64_t *cmd = __atomic_load_n(&tracked_pos, __ATOMIC_ACQUIRE);
+
+		if(cmd != NULL && FOLLOWING_ERROR_LIMIT > 0)
+		{
+			int64_t commanded = (int64_t)__atomic_load_n(cmd, __ATOMIC_RELAXED);
+			int64_t measured = (encoder_position() * tracked_steps_per_rev / ENCODER_COUNTS_PER_REV) * tracked_dir;
+			int64_t err = commanded - measured;
+
+			__atomic_store_n(&following_error, err, __ATOMIC_RELAXED);
+
+			if(llabs(err) > FOLLOWING_ERROR_LIMIT)
+			{
+				fault = true;
+			}
+		}
+
+		next.tv_nsec += ENCODER_MONITOR_PERIOD_NS;
+		tsnorm(&next);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+
+	return NULL;
+}
@@ -0,0 +1,57 @@
+/*
+*	encoder.h
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include <stdint.h>
+
+/**
+ * QUADRATURE ENCODER FEEDBACK
+ * The encoder A/B channels are decoded from WiringPi edge interrupts (which wiringPi services in its own threads),
+ * so decoding never runs inside the pulse loop. A separate monitor thread compares the measured position to the
+ * commanded motor_pos every ENCODER_MONITOR_PERIOD_NS and latches a fault if the following error exceeds
+ * FOLLOWING_ERROR_LIMIT. The pulse loop only has to check encoder_fault() once per edge.
+ **/
+
+/**
+ * Quadrature state table, indexed by (previous AB << 2) | current AB.
+ * Valid transitions count +1/-1, no change or an illegal double transition (both channels changed) counts 0.
+ * Shared with the gearing master input (gearing.h).
+ **/
+static inline int8_t encoder_quadrature_delta(const uint8_t last_ab, const uint8_t ab)
+{
+	static const int8_t QUADRATURE_TABLE[16] = {0, -1, 1, 0, 1, 0, 0, -1, -1, 0, 0, 1, 0, 1, -1, 0};
+
+	return QUADRATURE_TABLE[(last_ab << 2) | ab];
+}
+
+/* sets up the encoder inputs and starts the monitor thread. returns 0 on success, -1 on failure */
+int8_t encoder_init(void);
+
+/**
+ * Starts following a move.
+ * commanded_pos: the step counter that the pulse loop increments
+ * direction: 1 for CW, -1 for CCW
+ * steps_per_rev: drive steps per revolution, used to scale encoder counts into steps
+ **/
+void encoder_track(const uint64_t *commanded_pos, const int8_t direction, const int32_t steps_per_rev);
+
+/* stops comparing positions (the encoder keeps counting) */
+void encoder_untrack(void);
+
+/* 1 if the following error limit was exceeded during the current move */
+_Bool encoder_fault(void);
+
+/* measured position in encoder counts since the last encoder_track() */
+int64_t encoder_position(void);
+
+/* last sampled following error in steps (commanded - measured) */
+int64_t encoder_following_error(void);
+
+#endif /*ENCODER_H*/
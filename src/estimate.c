@@ -0,0 +1,337 @@
+/*
+*	estimate.c
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*	Offline cycle time estimator. Runs every move of a job file through execute_move() - the real planner, state
+*	machine and pulse loop - on virtual clocks (see timebase.h), so it needs no GPIO, no root and no RT kernel.
+*	Moves are independent, so they are spread over a pool of threads, one per core by default.
+*
+*/
+
+#include "motion_control.h"
+#include "pulse_train.h"
+#include "accel_curve.h"
+#include "resonance.h"
+#include "feed_override.h"
+#include "timebase.h"
+#include "globals.h"
+
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+extern const int32_t MAX_FREQ;
+
+#define MAX_THREADS 256
+
+struct job
+{
+	struct move_params mp;
+	int32_t line;
+	const char *invalid;	/* why the move can't run, NULL if it can */
+
+	/* filled in by the workers */
+	int result;
+	double seconds;
+	long double peak_freq;
+};
+
+static struct job *jobs = NULL;
+static int64_t job_count = 0;
+static int64_t next_job = 0;
+
+static void show_usage(void);
+static int8_t load_jobs(const char *path);
+static void *worker(void *arg);
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while((opt = getopt(argc, argv, "hj:T:R:F:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'j':
+				threads = atol(optarg);
+
+				if(threads <= 0 || threads > MAX_THREADS)
+				{
+					fprintf(stderr, "\nERROR: Number of threads must be between 1 and %d\n", MAX_THREADS);
+					return EXIT_FAILURE;
+				}
+				break;
+
+			case 'T':
+				if(accel_curve_load(optarg) != 0)
+				{
+					return EXIT_FAILURE;
+				}
+				break;
+
+			case 'R':
+				if(resonance_load(optarg) != 0)
+				{
+					return EXIT_FAILURE;
+				}
+				break;
+
+			case 'F':
+			{
+				int percent = atoi(optarg);
+
+				if(percent < FEED_OVERRIDE_MIN || percent > FEED_OVERRIDE_MAX)
+				{
+					fprintf(stderr, "\nERROR: Feed override must be between %d and %d percent\n", FEED_OVERRIDE_MIN, FEED_OVERRIDE_MAX);
+					return EXIT_FAILURE;
+				}
+
+				feed_override_set(percent);
+				break;
+			}
+
+			default:
+				show_usage();
+				return EXIT_FAILURE;
+		}
+	}
+
+	if(optind != argc - 1)
+	{
+		show_usage();
+		return EXIT_FAILURE;
+	}
+
+	if(load_jobs(argv[optind]) != 0)
+	{
+		return EXIT_FAILURE;
+	}
+
+	if(threads < 1)
+	{
+		threads = 1;
+	}
+
+	if(threads > job_count)
+	{
+		threads = (job_count > 0) ? job_count : 1;
+	}
+
+	/* the moves print their usual progress to stdout - keep that out of the report */
+	FILE *report = fdopen(dup(STDOUT_FILENO), "w");
+
+	if(report == NULL || freopen("/dev/null", "w", stdout) == NULL)
+	{
+		perror("\nERROR: Could not set up output");
+		return EXIT_FAILURE;
+	}
+
+	pthread_t pool[MAX_THREADS];
+
+	for(long i = 0; i < threads; i++)
+	{
+		if(pthread_create(&pool[i], NULL, worker, NULL) != 0)
+		{
+			perror("\nERROR: Could not start worker thread");
+			return EXIT_FAILURE;
+		}
+	}
+
+	for(long i = 0; i < threads; i++)
+	{
+		pthread_join(pool[i], NULL);
+	}
+
+	double total = 0;
+	long double peak = 0;
+	int64_t violations = 0;
+
+	fprintf(report, "move\tline\tsteps\ttime (s)\tpeak (Hz)\tresult\n");
+
+	for(int64_t i = 0; i < job_count; i++)
+	{
+		struct job *j = &jobs[i];
+		const char *result = "ok";
+
+		if(j->invalid != NULL)
+		{
+			result = j->invalid;
+		}
+		else if(j->result != 0)
+		{
+			result = "move failed";
+		}
+		else if(j->peak_freq > MAX_FREQ)
+		{
+			result = "peak frequency above the pulse frequency limit";
+		}
+
+		if(result[0] != 'o')
+		{
+			violations++;
+		}
+
+		total += j->seconds;
+
+		if(j->peak_freq > peak)
+		{
+			peak = j->peak_freq;
+		}
+
+		fprintf(report, "%" PRId64 "\t%d\t%" PRId64 "\t%.6f\t%.1Lf\t%s\n", i + 1, j->line, j->mp.num_steps, j->seconds, j->peak_freq, result);
+	}
+
+	fprintf(report, "\nMoves:\t\t\t%" PRId64 " (%ld threads)\n", job_count, threads);
+	fprintf(report, "Total time (s):\t\t%.6f\n", total);
+	fprintf(report, "Peak frequency (Hz):\t%.1Lf\n", peak);
+	fprintf(report, "Limit violations:\t%" PRId64 "\n", violations);
+	fclose(report);
+
+	free(jobs);
+	return (violations > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* each worker runs on its own virtual clock and takes the next move off the list until there are none left */
+static void *worker(void *arg)
+{
+	int64_t i;
+
+	timebase_use_virtual();
+
+	while((i = __atomic_fetch_add(&next_job, 1, __ATOMIC_RELAXED)) < job_count)
+	{
+		struct job *j = &jobs[i];
+		struct move_params mp = j->mp;
+		struct timespec t0;
+		struct timespec t1;
+
+		if(j->invalid != NULL)
+		{
+			continue;
+		}
+
+		timebase_now(&t0);
+		j->result = execute_move(&mp);
+		timebase_now(&t1);
+
+		j->seconds = (double)(t1.tv_sec - t0.tv_sec) + ((double)(t1.tv_nsec - t0.tv_nsec) / NSEC_PER_SEC);
+		j->peak_freq = pulse_peak_freq();
+	}
+
+	return NULL;
+}
+
+/**
+ * One move per line: starting_speed acc dec velocity num_steps [steps_per_rev], separated by whitespace or commas.
+ * Blank lines and lines starting with # are skipped.
+ **/
+static int8_t load_jobs(const char *path)
+{
+	FILE *fp;
+	char line[256];
+	int32_t line_no = 0;
+	int64_t size = 0;
+
+	if((fp = fopen(path, "r")) == NULL)
+	{
+		perror("\nERROR: Could not open job file");
+		return -1;
+	}
+
+	while(fgets(line, sizeof(line), fp) != NULL)
+	{
+		int s;
+		int a;
+		int d;
+		double v;
+		long long n;
+		int r = 2000;
+		char *p = line;
+
+		line_no++;
+		p += strspn(p, " \t");
+
+		if(*p == '#' || *p == '\n' || *p == '\r' || *p == 0)
+		{
+			continue;
+		}
+
+		for(char *c = p; *c != 0; c++)
+		{
+			if(*c == ',')
+			{
+				*c = ' ';
+			}
+		}
+
+		if(sscanf(p, "%d %d %d %lf %lld %d", &s, &a, &d, &v, &n, &r) < 5)
+		{
+			fprintf(stderr, "\nERROR: %s line %d: expected \"starting_speed acc dec velocity num_steps [steps_per_rev]\"\n", path, line_no);
+			fclose(fp);
+			return -1;
+		}
+
+		if(job_count == size)
+		{
+			size = (size == 0) ? 1024 : size * 2;
+			struct job *grown = realloc(jobs, size * sizeof(struct job));
+
+			if(grown == NULL)
+			{
+				fprintf(stderr, "\nERROR: Out of memory loading %s\n", path);
+				fclose(fp);
+				return -1;
+			}
+
+			jobs = grown;
+		}
+
+		struct job *j = &jobs[job_count++];
+		memset(j, 0, sizeof(*j));
+
+		j->mp = init_move_params();
+		j->mp.starting_speed = s;
+		j->mp.acc = a;
+		j->mp.dec = d;
+		j->mp.velocity = v;
+		j->mp.num_steps = n;
+		j->mp.steps_per_rev = r;
+		j->mp.CW = (n >= 0);
+		j->mp.CCW = (n < 0);
+		j->line = line_no;
+		j->invalid = move_params_check(&j->mp);
+	}
+
+	fclose(fp);
+
+	if(job_count == 0)
+	{
+		fprintf(stderr, "\nERROR: %s has no moves\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void show_usage(void)
+{
+	printf("\n");
+	printf("rhubarb_estimate - estimates the cycle time of a job without running the motor\n");
+	printf("\n");
+	printf("Usage: rhubarb_estimate [-j threads] [-T curve] [-R bands] [-F percent] <job file>\n");
+	printf("job file: one move per line, \"starting_speed acc dec velocity num_steps [steps_per_rev]\" (same units as rhubarb_motion)\n");
+	printf("-j: number of threads (default: one per core)\n");
+	printf("-T: acceleration vs speed curve, as for rhubarb_motion -T\n");
+	printf("-R: resonance bands, as for rhubarb_motion -R\n");
+	printf("-F: feed override in percent, as for rhubarb_motion -F\n");
+	printf("\n");
+	printf("Prints the time and peak frequency of every move and the total. Exits with failure if any move breaks a limit.\n");
+	printf("\n");
+}
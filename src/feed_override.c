@@ -0,0 +1,90 @@
+/*
+*	feed_override.c
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#include "feed_override.h"
+
+#include <signal.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+/* written from signal handlers, read by the pulse loop. a lock free 32 bit atomic, so both sides are async-signal-safe */
+static int32_t override = 100;
+
+static int32_t _clamp(const int32_t percent);
+static void _adjust(const int32_t delta);
+static void _feed_signal(int sig);
+
+int8_t feed_override_init(void)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = &_feed_signal;
+	sigemptyset(&sa.sa_mask);
+
+	/* SA_RESTART keeps a feed change from failing the odd blocking call elsewhere. the pulse loop retries its sleep on EINTR anyway */
+	sa.sa_flags = SA_RESTART;
+
+	if(sigaction(SIGUSR1, &sa, NULL) < 0 || sigaction(SIGUSR2, &sa, NULL) < 0)
+	{
+		perror("\nERROR: Could not install feed override handlers");
+		return -1;
+	}
+
+	return 0;
+}
+
+void feed_override_set(const int32_t percent)
+{
+	__atomic_store_n(&override, _clamp(percent), __ATOMIC_RELAXED);
+}
+
+int32_t feed_override_percent(void)
+{
+	return __atomic_load_n(&override, __ATOMIC_RELAXED);
+}
+
+long double feed_override(void)
+{
+	return feed_override_percent() / 100.0L;
+}
+
+static int32_t _clamp(const int32_t percent)
+{
+	if(percent < FEED_OVERRIDE_MIN)
+	{
+		return FEED_OVERRIDE_MIN;
+	}
+
+	if(percent > FEED_OVERRIDE_MAX)
+	{
+		return FEED_OVERRIDE_MAX;
+	}
+
+	return percent;
+}
+
+static void _adjust(const int32_t delta)
+{
+	int32_t cur = __atomic_load_n(&override, __ATOMIC_RELAXED);
+
+	while(!__atomic_compare_exchange_n(&override, &cur, _clamp(cur + delta), false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static void _feed_signal(int sig)
+{
+	if(sig == SIGUSR1)
+	{
+		_adjust(FEED_OVERRIDE_STEP);
+	}
+	else if(sig == SIGUSR2)
+	{
+		_adjust(-FEED_OVERRIDE_STEP);
+	}
+}
@@ -0,0 +1,40 @@
+/*
+*	feed_override.h
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#ifndef FEED_OVERRIDE_H
+#define FEED_OVERRIDE_H
+
+#include <stdint.h>
+
+#define FEED_OVERRIDE_MIN 10
+#define FEED_OVERRIDE_MAX 150
+#define FEED_OVERRIDE_STEP 10
+
+/**
+ * FEED RATE OVERRIDE
+ * Scales the commanded velocity of a move while it runs, in percent (FEED_OVERRIDE_MIN - FEED_OVERRIDE_MAX).
+ * The starting value is set with -F. While a move runs, send SIGUSR1 to raise it and SIGUSR2 to lower it by FEED_OVERRIDE_STEP:
+ *
+ *	kill -USR1 $(pidof rhubarb_motion)
+ *
+ * The pulse loop re-plans toward the new speed under the move's acc/dec limits (see trap_run()), the distance of the move does not change.
+ **/
+
+/* installs the SIGUSR1/SIGUSR2 handlers. returns 0 on success, -1 on failure */
+int8_t feed_override_init(void);
+
+/* sets the override in percent, clamped to the allowed range */
+void feed_override_set(const int32_t percent);
+
+/* the current override in percent */
+int32_t feed_override_percent(void);
+
+/* the current override as a velocity scale factor (1.0 == 100%) */
+long double feed_override(void);
+
+#endif /*FEED_OVERRIDE_H*/
@@ -0,0 +1,231 @@
+/*
+*	gearing.c
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#include "gearing.h"
+#include "globals.h"
+#include "encoder.h"
+
+#include <wiringPi.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+extern int8_t WIRINGPI_MASTER_A_INPUT;
+extern int8_t WIRINGPI_MASTER_B_INPUT;
+extern _Bool MASTER_STEP_DIR;
+
+static pthread_mutex_t decode_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t last_ab = 0;
+static int64_t master_pos = 0;
+static int64_t master_origin = 0;
+
+static int32_t ratio_num = 1;
+static int32_t ratio_den = 1;
+
+/* cam points and the slope to the next point, in CAM_FRAC_BITS fixed point. the slope has another CAM_FRAC_BITS fraction bits per count */
+static int32_t points = 0;
+static int64_t cam_spacing = 0;
+static int64_t cam_cycle = 0;
+static int64_t cam_rise = 0;
+static int64_t cam_pos[CAM_MAX_POINTS];
+static int64_t cam_slope[CAM_MAX_POINTS];
+
+static void _quadrature_isr(void);
+static void _step_isr(void);
+
+int8_t gearing_init(void)
+{
+	pinMode(WIRINGPI_MASTER_A_INPUT, INPUT);
+	pinMode(WIRINGPI_MASTER_B_INPUT, INPUT);
+
+	if(MASTER_STEP_DIR == true)
+	{
+		/* the direction has to be settled before the step edge, so only the step edge needs an interrupt */
+		pullUpDnControl(WIRINGPI_MASTER_A_INPUT, PUD_DOWN);
+		pullUpDnControl(WIRINGPI_MASTER_B_INPUT, PUD_DOWN);
+
+		if(wiringPiISR(WIRINGPI_MASTER_A_INPUT, INT_EDGE_RISING, &_step_isr) < 0)
+		{
+			fprintf(stderr, "\nERROR: Could not attach the master step interrupt\n");
+			return -1;
+		}
+
+		return 0;
+	}
+
+	pullUpDnControl(WIRINGPI_MASTER_A_INPUT, PUD_UP);
+	pullUpDnControl(WIRINGPI_MASTER_B_INPUT, PUD_UP);
+	last_ab = (uint8_t)((digitalRead(WIRINGPI_MASTER_A_INPUT) << 1) | digitalRead(WIRINGPI_MASTER_B_INPUT));
+
+	if(wiringPiISR(WIRINGPI_MASTER_A_INPUT, INT_EDGE_BOTH, &_quadrature_isr) < 0 || wiringPiISR(WIRINGPI_MASTER_B_INPUT, INT_EDGE_BOTH, &_quadrature_isr) < 0)
+	{
+		fprintf(stderr, "\nERROR: Could not attach the master encoder interrupts\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int8_t gearing_set_ratio(const int32_t num, const int32_t den)
+{
+	if(den == 0)
+	{
+		return -1;
+	}
+
+	/* keep the denominator positive, so the floor division below only has to look at the numerator's sign */
+	ratio_num = (den < 0) ? -num : num;
+	ratio_den = (den < 0) ? -den : den;
+	return 0;
+}
+
+int8_t cam_load(const char *path)
+{
+	FILE *fp;
+	char line[256];
+	int32_t line_no = 0;
+	int64_t master[CAM_MAX_POINTS];
+
+	if((fp = fopen(path, "r")) == NULL)
+	{
+		perror("\nERROR: Could not open cam table");
+		return -1;
+	}
+
+	points = 0;
+
+	while(fgets(line, sizeof(line), fp) != NULL)
+	{
+		long long m;
+		double s;
+		char *p = line;
+
+		line_no++;
+		p += strspn(p, " \t");
+
+		if(*p == '#' || *p == '\n' || *p == '\r' || *p == 0)
+		{
+			continue;
+		}
+
+		if(sscanf(p, "%lld%*[ \t,]%lf", &m, &s) != 2 || fabs(s) >= (double)(INT64_C(1) << (62 - (2 * CAM_FRAC_BITS))))
+		{
+			fprintf(stderr, "\nERROR: %s line %d: expected \"master slave\" with master in counts\n", path, line_no);
+			fclose(fp);
+			points = 0;
+			return -1;
+		}
+
+		if(points == CAM_MAX_POINTS)
+		{
+			fprintf(stderr, "\nERROR: %s has more than %d points\n", path, CAM_MAX_POINTS);
+			fclose(fp);
+			points = 0;
+			return -1;
+		}
+
+		/* the fixed spacing is what makes the lookup constant time */
+		if((points == 0 && m != 0) || (points == 1 && m <= 0) || (points > 1 && m - master[points - 1] != master[1]))
+		{
+			fprintf(stderr, "\nERROR: %s line %d: master positions must start at 0 and increase in equal steps\n", path, line_no);
+			fclose(fp);
+			points = 0;
+			return -1;
+		}
+
+		master[points] = m;
+		cam_pos[points] = llround(s * (1 << CAM_FRAC_BITS));
+		points++;
+	}
+
+	fclose(fp);
+
+	if(points < 2)
+	{
+		fprintf(stderr, "\nERROR: %s needs at least two points\n", path);
+		points = 0;
+		return -1;
+	}
+
+	cam_spacing = master[1];
+	cam_cycle = master[points - 1];
+	cam_rise = cam_pos[points - 1] - cam_pos[0];
+
+	for(int32_t i = 0; i < points - 1; i++)
+	{
+		cam_slope[i] = ((cam_pos[i + 1] - cam_pos[i]) * (1 << CAM_FRAC_BITS)) / cam_spacing;
+	}
+
+	return 0;
+}
+
+_Bool cam_active(void)
+{
+	return points > 0;
+}
+
+void gearing_start(void)
+{
+	__atomic_store_n(&master_origin, __atomic_load_n(&master_pos, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+int64_t gearing_master_position(void)
+{
+	return __atomic_load_n(&master_pos, __ATOMIC_RELAXED) - __atomic_load_n(&master_origin, __ATOMIC_RELAXED);
+}
+
+/* integer division rounding towards minus infinity, so the slave moves the same way on both sides of the origin */
+static inline int64_t _floor_div(const int64_t a, const int64_t b)
+{
+	int64_t q = a / b;
+	return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+int64_t gearing_target(void)
+{
+	int64_t m = gearing_master_position();
+
+	if(points == 0)
+	{
+		return _floor_div(m * ratio_num, ratio_den);
+	}
+
+	/* which cycle, which segment of the table and how far into it */
+	int64_t cycle = _floor_div(m, cam_cycle);
+	int64_t r = m - (cycle * cam_cycle);
+	int64_t i = r / cam_spacing;
+	int64_t f = r - (i * cam_spacing);
+
+	int64_t slave = (cycle * cam_rise) + (cam_pos[i] - cam_pos[0]) + ((cam_slope[i] * f) >> CAM_FRAC_BITS);
+
+	return slave >> CAM_FRAC_BITS;
+}
+
+static void _quadrature_isr(void)
+{
+	pthread_mutex_lock(&decode_lock);
+
+	uint8_t ab = (uint8_t)((digitalRead(WIRINGPI_MASTER_A_INPUT) << 1) | digitalRead(WIRINGPI_MASTER_B_INPUT));
+	int8_t delta = encoder_quadrature_delta(last_ab, ab);
+	last_ab = ab;
+
+	if(delta != 0)
+	{
+		__atomic_store_n(&master_pos, master_pos + delta, __ATOMIC_RELAXED);
+	}
+
+	pthread_mutex_unlock(&decode_lock);
+}
+
+static void _step_isr(void)
+{
+	/* a HIGH direction is CW, like our own direction output */
+	__atomic_fetch_add(&master_pos, (digitalRead(WIRINGPI_MASTER_B_INPUT) == HIGH) ? 1 : -1, __ATOMIC_RELAXED);
+}
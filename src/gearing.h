@@ -0,0 +1,61 @@
+/*
+*	gearing.h
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#ifndef GEARING_H
+#define GEARING_H
+
+#include <stdint.h>
+
+#define CAM_MAX_POINTS 1024
+
+/* fractional bits of the fixed point cam positions */
+#define CAM_FRAC_BITS 16
+
+/**
+ * ELECTRONIC GEARING AND CAMS
+ * In follow mode (-M) this axis is slaved to a master: a quadrature encoder, or the step and direction signals of another
+ * axis. The master is counted from wiringPi edge interrupts, like the encoder feedback, and its position is turned
+ * into a slave position in steps through either
+ *
+ *	a gear ratio (-G num:den): slave = master * num / den, exactly, with a negative num reversing the slave, or
+ *	a cam table (-C): one "master slave" point per line, master in counts from 0 in equal steps, slave in steps
+ *
+ *		# master	slave
+ *		0			0
+ *		500			120.5
+ *		1000		400
+ *
+ * The cam repeats every time the master passes the last point, each cycle carrying on from where the last one ended
+ * (a cam that ends at 0 returns the slave, one that doesn't is a feed). Between points the slave is interpolated
+ * linearly. Points and slopes are kept in fixed point and the master spacing is fixed, so gearing_target() is a few
+ * integer operations - no search, no floating point - and cheap enough to call on every edge of the pulse loop.
+ * Both the master and the slave are counted from where they were when following started.
+ **/
+
+/* sets up the master inputs (WIRINGPI_MASTER_A_INPUT/B, MASTER_STEP_DIR). returns 0 on success, -1 on failure */
+int8_t gearing_init(void);
+
+/* sets the gear ratio. returns 0 on success, -1 if den is 0 */
+int8_t gearing_set_ratio(const int32_t num, const int32_t den);
+
+/* loads a cam table instead of the ratio. returns 0 on success, -1 on failure (the error is printed) */
+int8_t cam_load(const char *path);
+
+/* 1 if a cam table was loaded */
+_Bool cam_active(void);
+
+/* makes the current master position the origin */
+void gearing_start(void);
+
+/* master position in counts since gearing_start() */
+int64_t gearing_master_position(void);
+
+/* where the slave should be for the current master position, in steps since gearing_start() */
+int64_t gearing_target(void);
+
+#endif /*GEARING_H*/
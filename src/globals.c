@@ -13,8 +13,52 @@ const int32_t MAX_FREQ = 30000;
 int8_t WIRINGPI_PULSE_OUTPUT = 29;
 int8_t WIRINGPI_DIRECTION_OUTPUT = 26;
 int8_t WIRINGPI_ESTOP_INPUT = 0;
+int8_t WIRINGPI_ENCODER_A_INPUT = -1;
+int8_t WIRINGPI_ENCODER_B_INPUT = -1;
+int8_t WIRINGPI_HOME_INPUT = -1;
+int8_t WIRINGPI_MASTER_A_INPUT = -1;
+int8_t WIRINGPI_MASTER_B_INPUT = -1;
+
+/* encoder feedback is disabled unless both inputs are given. a limit of 0 disables the following error check */
+int32_t ENCODER_COUNTS_PER_REV = 4000;
+int32_t FOLLOWING_ERROR_LIMIT = 0;
+
+/* enum overrun_policy (pulse_train.h) - catch up, but never faster than MAX_FREQ */
+int8_t OVERRUN_POLICY = 0;
+int32_t CATCHUP_MAX_FREQ = 30000;
+
+/* deceleration for Ctrl-C/SIGTERM stops in steps/s^2. 0 uses the move's deceleration */
+int32_t STOP_DECEL = 0;
+
+/* the pulse loop thread's scheduler (enum rt_sched_policy, see rt_sched.h). a deadline runtime/period of 0 is derived from the step rate */
+int8_t SCHED_POLICY = 0;
+int32_t SCHED_PRIORITY = 85;
+int32_t SCHED_RUNTIME_US = 0;
+int32_t SCHED_PERIOD_US = 0;
+
+/* sleep between edges on a timerfd instead of clock_nanosleep() (see timebase.h) */
+_Bool TIMERFD_SLEEP = false;
+
+/* pulse loop watchdog timeout (0 disables it) and core (-1 is the last one), see watchdog.h */
+int32_t WATCHDOG_TIMEOUT_US = 0;
+int32_t WATCHDOG_CPU = -1;
+
+/* homing re-approach speed in steps/s (0 uses the starting speed), extra back-off in steps, and home switch interrupt latency */
+int32_t HOME_SPEED = 0;
+int32_t HOME_BACKOFF_STEPS = 100;
+int32_t HOME_LATENCY_US = 0;
+
+/* the gearing master (see gearing.h) is a quadrature encoder on A,B, or the step and direction signals of another axis */
+_Bool MASTER_STEP_DIR = false;
 
 _Bool VERBOSE = false;
 _Bool NO_MOTOR = false;
+_Bool PERF_COUNTERS = false;
 
 char OUTPUT_FILE_PATH[PATH_MAX] = {0};
+char TELEMETRY_SHM_NAME[NAME_MAX] = {0};
+char TRACE_FILE_PATH[PATH_MAX] = {0};
+uint32_t TRACE_FILE_SIZE_MB = 64;
+char PLAN_CACHE_PATH[PATH_MAX] = {0};
+uint32_t PLAN_CACHE_ENTRIES = 64;
+char POSITION_FILE_PATH[PATH_MAX] = {0};
@@ -14,6 +14,11 @@
 
 #define PULSE_ERR_ESTOP -2
 #define PULSE_ERR_FAIL -1
+#define PULSE_ERR_FOLLOWING -3
+#define PULSE_ERR_OVERRUN -4
+#define PULSE_ERR_STOPPED -5
+#define PULSE_ERR_HOMED -6
+#define PULSE_ERR_WATCHDOG -7
 
 #include <stdint.h>
 #include <linux/limits.h>
@@ -24,10 +29,46 @@ const int32_t MAX_FREQ;
 int8_t WIRINGPI_PULSE_OUTPUT;
 int8_t WIRINGPI_DIRECTION_OUTPUT;
 int8_t WIRINGPI_ESTOP_INPUT;
+int8_t WIRINGPI_ENCODER_A_INPUT;
+int8_t WIRINGPI_ENCODER_B_INPUT;
+int8_t WIRINGPI_HOME_INPUT;
+int8_t WIRINGPI_MASTER_A_INPUT;
+int8_t WIRINGPI_MASTER_B_INPUT;
+
+int32_t ENCODER_COUNTS_PER_REV;
+int32_t FOLLOWING_ERROR_LIMIT;
+
+int8_t OVERRUN_POLICY;
+int32_t CATCHUP_MAX_FREQ;
+
+int32_t STOP_DECEL;
+
+int8_t SCHED_POLICY;
+int32_t SCHED_PRIORITY;
+int32_t SCHED_RUNTIME_US;
+int32_t SCHED_PERIOD_US;
+
+_Bool TIMERFD_SLEEP;
+
+int32_t WATCHDOG_TIMEOUT_US;
+int32_t WATCHDOG_CPU;
+
+int32_t HOME_SPEED;
+int32_t HOME_BACKOFF_STEPS;
+int32_t HOME_LATENCY_US;
+
+_Bool MASTER_STEP_DIR;
 
 _Bool VERBOSE;
 _Bool NO_MOTOR;
+_Bool PERF_COUNTERS;
 
 char OUTPUT_FILE_PATH[PATH_MAX];
+char TELEMETRY_SHM_NAME[NAME_MAX];
+char TRACE_FILE_PATH[PATH_MAX];
+uint32_t TRACE_FILE_SIZE_MB;
+char PLAN_CACHE_PATH[PATH_MAX];
+uint32_t PLAN_CACHE_ENTRIES;
+char POSITION_FILE_PATH[PATH_MAX];
 
 #endif /*GLOBALS_H*/
@@ -0,0 +1,309 @@
+/*
+*	homing.c
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#include "homing.h"
+#include "globals.h"
+#include "debounce.h"
+#include "pulse_train.h"
+#include "position.h"
+#include "state_machine.h"
+#include "trace.h"
+
+#include <wiringPi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+
+extern int8_t WIRINGPI_DIRECTION_OUTPUT;
+extern int32_t HOME_SPEED;
+extern int32_t HOME_BACKOFF_STEPS;
+extern int32_t HOME_LATENCY_US;
+
+/* how often the debounced switch is sampled while the axis stands still */
+#define HOME_SAMPLE_NS 1000000
+
+static int8_t home_input = -1;
+
+/* the step counter being watched, NULL while disarmed. set by the pulse loop thread, read by the interrupt */
+static const uint64_t *armed_pos = NULL;
+static volatile _Bool triggered = false;
+static uint64_t captured_pos = 0;
+
+static void _home_isr(void)
+{
+	const uint64_t *pos = __atomic_load_n(&armed_pos, __ATOMIC_ACQUIRE);
+
+	/* only the first rising edge counts - bounces after it don't move the capture */
+	if(pos == NULL || triggered == true || digitalRead(home_input) != HIGH)
+	{
+		return;
+	}
+
+	captured_pos = __atomic_load_n(pos, __ATOMIC_RELAXED);
+	__atomic_store_n(&triggered, true, __ATOMIC_RELEASE);
+}
+
+static void _arm(const uint64_t *pos)
+{
+	__atomic_store_n(&triggered, false, __ATOMIC_RELAXED);
+	__atomic_store_n(&armed_pos, pos, __ATOMIC_RELEASE);
+}
+
+static void _disarm(void)
+{
+	__atomic_store_n(&armed_pos, NULL, __ATOMIC_RELEASE);
+}
+
+static void _set_direction(const int8_t direction)
+{
+	/* for the AMCI SD7540, a HIGH output is CW */
+	digitalWrite(WIRINGPI_DIRECTION_OUTPUT, (direction > 0) ? 1 : 0);
+	trace_direction((direction > 0) ? 1 : 0);
+}
+
+/* reads the switch through the debouncer while the axis stands still. starts the integrator halfway so it settles either way */
+static _Bool _switch_active(void)
+{
+	int16_t integrator = 16;
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	for(;;)
+	{
+		if(debounce_input_read(home_input, &integrator, t) == 1)
+		{
+			return true;
+		}
+
+		if(integrator == 0)
+		{
+			return false;
+		}
+
+		t.tv_nsec += HOME_SAMPLE_NS;
+		tsnorm(&t);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+	}
+}
+
+int8_t homing_init(const int8_t input)
+{
+	home_input = input;
+
+	pinMode(home_input, INPUT);
+	pullUpDnControl(home_input, PUD_DOWN);
+
+	if(wiringPiISR(home_input, INT_EDGE_RISING, &_home_isr) < 0)
+	{
+		fprintf(stderr, "\nERROR: Could not attach home switch interrupt\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+_Bool homing_triggered(void)
+{
+	return triggered == true && __atomic_load_n(&armed_pos, __ATOMIC_RELAXED) != NULL;
+}
+
+/**
+ * the homing profile. the three moves are states, and any failure goes to the fail state.
+ * the cycle's parameters and results are shared by the states here - homing runs once, on the main thread
+ **/
+enum homing_states {home_seek, home_back_off, home_approach, home_done, home_fail};
+
+static const struct move_params *home_mp;
+static int64_t home_at;
+static int8_t home_direction;
+static int32_t home_slow;
+static uint64_t home_overshoot;
+static int64_t home_back_steps;
+static struct timespec home_t0;
+
+static int _state_seek(void);
+static int _state_back_off(void);
+static int _state_approach(void);
+static int _state_done(void);
+static int _state_fail(void);
+
+static const struct sm_state homing_states[] =
+{
+	[home_seek] = {"seek", _state_seek, false, false},
+	[home_back_off] = {"back off", _state_back_off, false, false},
+	[home_approach] = {"approach", _state_approach, false, false},
+	[home_done] = {"homed", _state_done, true, false},
+	[home_fail] = {"homing failed", _state_fail, true, true}
+};
+
+static const struct sm_transition homing_transitions[] =
+{
+	{home_seek, sm_done, home_back_off},
+	{home_seek, sm_fail, home_fail},
+	{home_seek, sm_repeat, home_seek},
+	{home_seek, sm_stop, home_fail},
+
+	{home_back_off, sm_done, home_approach},
+	{home_back_off, sm_fail, home_fail},
+	{home_back_off, sm_repeat, home_back_off},
+	{home_back_off, sm_stop, home_fail},
+
+	{home_approach, sm_done, home_done},
+	{home_approach, sm_fail, home_fail},
+	{home_approach, sm_repeat, home_approach},
+	{home_approach, sm_stop, home_fail}
+};
+
+static struct sm_profile homing = {"homing", homing_states, sizeof(homing_states) / sizeof(homing_states[0]), home_seek, false};
+
+int8_t homing_run(const struct move_params *mp, const int64_t home_position)
+{
+	if(homing.registered == false && sm_register(&homing, homing_transitions, sizeof(homing_transitions) / sizeof(homing_transitions[0])) != 0)
+	{
+		return -1;
+	}
+
+	home_mp = mp;
+	home_at = home_position;
+	home_direction = (mp->num_steps < 0) ? -1 : 1;
+	home_slow = (HOME_SPEED > 0) ? HOME_SPEED : mp->starting_speed;
+	home_overshoot = 0;
+	home_back_steps = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &home_t0);
+
+	return (sm_run(&homing) == EXIT_SUCCESS) ? 0 : -1;
+}
+
+/* 1. fast seek - unless we are already sitting on the switch */
+static int _state_seek(void)
+{
+	if(_switch_active() == true)
+	{
+		return sm_done;
+	}
+
+	struct move_params seek = *home_mp;
+
+	fprintf(stderr, "\nHoming: seeking the home switch at %.0f steps/s...\n", home_mp->velocity);
+	_set_direction(home_direction);
+	_arm(move_position());
+	int ret = execute_move(&seek);
+	_disarm();
+
+	if(triggered == false)
+	{
+		if(ret == 0)
+		{
+			fprintf(stderr, "\nERROR: Home switch not found within %" PRId64 " steps\n", (int64_t)llabs(home_mp->num_steps));
+		}
+		else
+		{
+			fprintf(stderr, "\nERROR: Homing seek failed\n");
+		}
+
+		return sm_fail;
+	}
+
+	/* how far the decel carried us past the switch */
+	home_overshoot = *move_position() - captured_pos;
+	return sm_done;
+}
+
+/* 2. back off until the switch is clear */
+static int _state_back_off(void)
+{
+	struct move_params back = *home_mp;
+
+	back.num_steps = -home_direction * (int64_t)(home_overshoot + HOME_BACKOFF_STEPS);
+	back.CW = (back.num_steps > 0);
+	back.CCW = (back.num_steps < 0);
+	home_back_steps = llabs(back.num_steps);
+
+	fprintf(stderr, "\nHoming: backing off %" PRId64 " steps...\n", home_back_steps);
+	_set_direction(-home_direction);
+
+	if(execute_move(&back) != 0)
+	{
+		fprintf(stderr, "\nERROR: Homing back-off failed\n");
+		return sm_fail;
+	}
+
+	if(_switch_active() == true)
+	{
+		fprintf(stderr, "\nERROR: Still on the home switch after backing off, try a longer back-off (-u)\n");
+		return sm_fail;
+	}
+
+	return sm_done;
+}
+
+/* 3. slow re-approach as a constant speed pulse train. the switch has to come within the distance we backed off, with some margin */
+static int _state_approach(void)
+{
+	uint64_t pos = 0;
+	int64_t limit = 2 * home_back_steps;
+
+	fprintf(stderr, "\nHoming: approaching the home switch at %d steps/s...\n", home_slow);
+	_set_direction(home_direction);
+	pulse_reset_overruns();
+	_arm(&pos);
+	pulse_train(home_slow, &limit, &pos);
+	_disarm();
+
+	if(triggered == false)
+	{
+		fprintf(stderr, "\nERROR: Home switch not found on the slow approach\n");
+		return sm_fail;
+	}
+
+	if(_switch_active() == false)
+	{
+		fprintf(stderr, "\nERROR: Home switch did not stay active, rejecting the capture as noise\n");
+		return sm_fail;
+	}
+
+	/* the interrupt came HOME_LATENCY_US after the edge - at constant speed, that is slow * latency steps */
+	double edge = (double)captured_pos - ((double)home_slow * HOME_LATENCY_US / 1e6);
+	int64_t past = llround((double)pos - edge);
+
+	position_set(home_at + (home_direction * past));
+
+	printf("\nHOMING COMPLETE:\n");
+	printf("Switch edge captured at (steps):\t%.2f of the approach (latched %" PRIu64 ", latency %dus)\n", edge, captured_pos, HOME_LATENCY_US);
+	printf("Stopped past the edge (steps):\t\t%" PRId64 "\n", past);
+	printf("Fast seek overshoot (steps):\t\t%" PRIu64 "\n", home_overshoot);
+
+	return sm_done;
+}
+
+static int _state_done(void)
+{
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	printf("Homing time (s):\t\t\t%F\n", (t1.tv_sec - home_t0.tv_sec) + ((t1.tv_nsec - home_t0.tv_nsec) / 1e9));
+
+	if(position_active() == true)
+	{
+		printf("Absolute position (steps):\t\t%" PRId64 "\n", position_get());
+	}
+
+	return sm_done;
+}
+
+/* the failing state already printed why */
+static int _state_fail(void)
+{
+	_disarm();
+	return sm_fail;
+}
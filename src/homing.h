@@ -0,0 +1,41 @@
+/*
+*	homing.h
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#ifndef HOMING_H
+#define HOMING_H
+
+#include <stdint.h>
+
+#include "motion_control.h"
+
+/**
+ * HOMING
+ * Finds the home switch (see -H) in three moves:
+ * 1. a fast seek toward the switch with the move's -s/-a/-d/-v, for at most -n steps (the sign of -n is the direction).
+ *    The switch edge stops the seek with a controlled deceleration, so the axis ends up somewhat past the switch
+ * 2. a back-off away from the switch, by the overshoot plus HOME_BACKOFF_STEPS (-u)
+ * 3. a slow re-approach at HOME_SPEED (-j, default -s) as a plain pulse train, which stops at the switch
+ *
+ * The switch edge is captured by an interrupt, which latches the step count at that moment. The interrupt arrives
+ * HOME_LATENCY_US (-U) after the edge, so at the constant re-approach speed the edge itself was speed * latency steps
+ * earlier. The position of the switch edge becomes 0 - or the -L position - in the position file.
+ * The switch has to read active through the debounced input once the axis has stopped, or the capture is rejected as noise.
+ *
+ * The three moves are the states of the homing profile (see state_machine.h), each seek move itself a trapezoid profile.
+ **/
+
+/* attaches the home switch interrupt. returns 0 on success, -1 on failure */
+int8_t homing_init(const int8_t input);
+
+/* 1 once the armed switch edge has been captured - the pulse loop stops on this */
+_Bool homing_triggered(void);
+
+/* runs the homing cycle. home_position is the position of the switch edge. returns 0 on success, -1 on failure */
+int8_t homing_run(const struct move_params *mp, const int64_t home_position);
+
+#endif /*HOMING_H*/
@@ -0,0 +1,92 @@
+/*
+*	jog.c
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#include "jog.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+static int32_t command = 0;
+static _Bool quit = false;
+static int32_t limit = 0;
+static pthread_t reader_thread;
+
+static void *_jog_reader(void *arg)
+{
+	char line[64];
+
+	while(fgets(line, sizeof(line), stdin) != NULL)
+	{
+		char *p = line + strspn(line, " \t");
+		char *end;
+
+		if(*p == 'q')
+		{
+			break;
+		}
+
+		long v = strtol(p, &end, 10);
+
+		if(end == p)
+		{
+			fprintf(stderr, "Jog: expected a velocity in steps/s or q\n");
+			continue;
+		}
+
+		if(labs(v) > limit)
+		{
+			v = (v < 0) ? -limit : limit;
+		}
+
+		__atomic_store_n(&command, (int32_t)v, __ATOMIC_RELAXED);
+		fprintf(stderr, "Jog: %ld steps/s %s\n", labs(v), (v == 0) ? "(hold)" : ((v > 0) ? "CW" : "CCW"));
+	}
+
+	__atomic_store_n(&quit, true, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+int8_t jog_init(const int32_t max_velocity)
+{
+	pthread_attr_t attr;
+	struct sched_param param;
+
+	limit = max_velocity;
+
+	/* the reader must not compete with the pulse loop - it would otherwise inherit SCHED_FIFO from rt_setup() */
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+	param.sched_priority = 0;
+	pthread_attr_setschedparam(&attr, &param);
+
+	if(pthread_create(&reader_thread, &attr, &_jog_reader, NULL) != 0)
+	{
+		pthread_attr_destroy(&attr);
+		fprintf(stderr, "\nERROR: Could not start jog command reader\n");
+		return -1;
+	}
+
+	pthread_attr_destroy(&attr);
+	pthread_detach(reader_thread);
+	return 0;
+}
+
+int32_t jog_command(void)
+{
+	return __atomic_load_n(&command, __ATOMIC_RELAXED);
+}
+
+_Bool jog_quit_requested(void)
+{
+	return __atomic_load_n(&quit, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,34 @@
+/*
+*	jog.h
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#ifndef JOG_H
+#define JOG_H
+
+#include <stdint.h>
+
+/**
+ * JOG COMMANDS
+ * In jog mode (-J) the axis runs at whatever velocity was last commanded on stdin, one command per line:
+ *
+ *	<velocity>	signed velocity in steps/s, positive is CW. 0 stops and holds
+ *	q			stops and exits (so does the end of the input, and Ctrl-C)
+ *
+ * The commands are read by a normal priority thread and handed to the pulse loop as a single atomic value.
+ * The pulse loop ramps to the new velocity at -a/-d, see jog() in pulse_train.h.
+ **/
+
+/* starts the command reader. max_velocity (-v) limits the commands. returns 0 on success, -1 on failure */
+int8_t jog_init(const int32_t max_velocity);
+
+/* the last commanded velocity in steps/s, signed */
+int32_t jog_command(void);
+
+/* 1 once q or the end of the input was read */
+_Bool jog_quit_requested(void);
+
+#endif /*JOG_H*/
@@ -14,6 +14,22 @@
 #include "globals.h"
 #include "motion_control.h"
 #include "pulse_train.h"
+#include "encoder.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "feed_override.h"
+#include "stop_request.h"
+#include "accel_curve.h"
+#include "resonance.h"
+#include "gearing.h"
+#include "perf_counters.h"
+#include "plan_cache.h"
+#include "position.h"
+#include "homing.h"
+#include "jog.h"
+#include "rt_sched.h"
+#include "timebase.h"
+#include "watchdog.h"
 
 #include <sys/stat.h>
 #include <getopt.h>
@@ -34,9 +50,33 @@
 extern int8_t WIRINGPI_PULSE_OUTPUT;
 extern int8_t WIRINGPI_DIRECTION_OUTPUT;
 extern int8_t WIRINGPI_ESTOP_INPUT;
+extern int8_t WIRINGPI_ENCODER_A_INPUT;
+extern int8_t WIRINGPI_ENCODER_B_INPUT;
+extern int32_t ENCODER_COUNTS_PER_REV;
+extern int32_t FOLLOWING_ERROR_LIMIT;
+extern int8_t OVERRUN_POLICY;
+extern int32_t CATCHUP_MAX_FREQ;
+extern int32_t STOP_DECEL;
+extern int8_t WIRINGPI_HOME_INPUT;
+extern int32_t HOME_SPEED;
+extern int32_t HOME_BACKOFF_STEPS;
+extern int32_t HOME_LATENCY_US;
+extern int8_t WIRINGPI_MASTER_A_INPUT;
+extern int8_t WIRINGPI_MASTER_B_INPUT;
+extern _Bool MASTER_STEP_DIR;
 extern _Bool VERBOSE;
 extern _Bool NO_MOTOR;
+extern _Bool PERF_COUNTERS;
+extern _Bool TIMERFD_SLEEP;
+extern int32_t WATCHDOG_TIMEOUT_US;
+extern int32_t WATCHDOG_CPU;
 extern char OUTPUT_FILE_NAME[PATH_MAX];
+extern char TELEMETRY_SHM_NAME[NAME_MAX];
+extern char TRACE_FILE_PATH[PATH_MAX];
+extern uint32_t TRACE_FILE_SIZE_MB;
+extern char PLAN_CACHE_PATH[PATH_MAX];
+extern uint32_t PLAN_CACHE_ENTRIES;
+extern char POSITION_FILE_PATH[PATH_MAX];
 
 struct move_params mp;
 
@@ -57,6 +97,8 @@ int main(int argc, char *argv[])
 	check_rt();
 
 	/* if we pass the checks, setup a PREEMPT environment */
+	/* the RT setup spans are held until parse_args knows whether there is a trace to write them to */
+	trace_setup_begin();
 	rt_setup();
 
 	/* parse command line arguments and also check that the inputs are within range
@@ -70,25 +112,22 @@ int main(int argc, char *argv[])
 void rt_setup()
 {
 	
-	/* declare ourselves as a realtime task and set the scheduler */
-	struct sched_param param;
-	param.sched_priority = 85;
-	if(sched_setscheduler(0, SCHED_FIFO, &param) == -1)
-	{
-		perror("Could not set scheduler");
-		exit(EXIT_FAILURE);
-	}
+	/* the realtime scheduler is set by rt_sched_apply() once the options are parsed - a deadline reservation depends on the step rate */
 
 	/* lock memory to prevent page faults - mlockall forces the executing program to lock all memory to RAM, not swap, which is slow */
+	trace_span_begin(trace_span_rt_mlock);
 	if(mlockall(MCL_CURRENT|MCL_FUTURE) == -1)
 	{
 		perror("mlockall failed");
 		exit(EXIT_FAILURE);
 	}
+	trace_span_end(trace_span_rt_mlock);
 	
 	/* prefault the stack. set aside memory so that there are no interrupts when the system loads the memory pages into cache */
+	trace_span_begin(trace_span_rt_stack);
 	unsigned char dummy[MAX_SAFE_STACK];
 	memset(dummy, 0, MAX_SAFE_STACK);
+	trace_span_end(trace_span_rt_stack);
 
 }
 
@@ -97,6 +136,14 @@ void parse_args(int argc, char **argv)
 	int8_t opt = 0;
 	int32_t freq = 0;
 	int8_t pulse_flag = 0;
+	_Bool jog_flag = false;
+	_Bool sweep_flag = false;
+	struct sweep_params sweep = {0, 0, false, 0, 0, 0};
+	_Bool set_position = false;
+	int64_t new_position = 0;
+	_Bool absolute = false;
+	int64_t target = 0;
+	char replay_path[PATH_MAX] = {0};
 
 	/* by default, if no options are given, just show the usage */
 	if(argc == 1)
@@ -104,7 +151,7 @@ void parse_args(int argc, char **argv)
 		show_usage();
 	}
 
-	while ((opt = getopt(argc, argv, "yhs:q:r:g:a:d:v:n:z:t:x:o:")) != -1)
+	while ((opt = getopt(argc, argv, "yhs:q:r:g:a:d:v:n:z:t:x:o:e:c:f:m:b:B:p:P:F:S:T:k:K:l:L:A:H:j:u:U:Jw:W:D:R:M:G:C:IE:NX:Z:")) != -1)
 	{
 		switch (opt) {
 			
@@ -262,12 +309,330 @@ void parse_args(int argc, char **argv)
 				break;
 			}
 
+			case 'e':
+			{
+				int a = -1;
+				int b = -1;
+
+				if(sscanf(optarg, "%d,%d", &a, &b) != 2 || a < 0 || a >= 26 || b < 0 || b >= 26 || a == b)
+				{
+					printf("\nERROR: You must specify two different valid WiringPi inputs for the encoder as A,B\n");
+					exit(EXIT_FAILURE);
+				}
+
+				WIRINGPI_ENCODER_A_INPUT = a;
+				WIRINGPI_ENCODER_B_INPUT = b;
+				break;
+			}
+
+			case 'c':
+				ENCODER_COUNTS_PER_REV = atoi(optarg);
+
+				if(ENCODER_COUNTS_PER_REV <= 0)
+				{
+					printf("\nERROR: Encoder counts per rev cannot be less than or equal to zero\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'f':
+				FOLLOWING_ERROR_LIMIT = atoi(optarg);
+
+				if(FOLLOWING_ERROR_LIMIT < 0)
+				{
+					printf("\nERROR: Following error limit cannot be negative\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'm':
+				/* POSIX shared memory names are a single leading slash followed by the name */
+				if(optarg[0] != '/' || strchr(optarg + 1, '/') != NULL || strlen(optarg) < 2)
+				{
+					printf("\nERROR: Telemetry segment name must look like /name\n");
+					exit(EXIT_FAILURE);
+				}
+
+				strlcpy(TELEMETRY_SHM_NAME, optarg, sizeof(TELEMETRY_SHM_NAME));
+				break;
+
+			case 'b':
+				strlcpy(TRACE_FILE_PATH, optarg, sizeof(TRACE_FILE_PATH));
+				break;
+
+			case 'Z':
+				strlcpy(replay_path, optarg, sizeof(replay_path));
+				break;
+
+			case 'B':
+			{
+				int size = atoi(optarg);
+
+				if(size <= 0 || size > 4096)
+				{
+					printf("\nERROR: Trace file size must be between 1 and 4096 MB\n");
+					exit(EXIT_FAILURE);
+				}
+
+				TRACE_FILE_SIZE_MB = size;
+				break;
+			}
+
+			case 'p':
+				if(strcmp(optarg, "catchup") == 0)
+				{
+					OVERRUN_POLICY = overrun_catchup;
+				}
+				else if(strcmp(optarg, "reanchor") == 0)
+				{
+					OVERRUN_POLICY = overrun_reanchor;
+				}
+				else if(strcmp(optarg, "abort") == 0)
+				{
+					OVERRUN_POLICY = overrun_abort;
+				}
+				else
+				{
+					printf("\nERROR: Overrun policy must be one of catchup, reanchor or abort\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'P':
+				CATCHUP_MAX_FREQ = atoi(optarg);
+
+				if(CATCHUP_MAX_FREQ > MAX_FREQ || CATCHUP_MAX_FREQ <= 0)
+				{
+					fprintf(stderr, "\nERROR: Catch-up frequency cannot be greater than %dHz or less than or equal to 0\n", MAX_FREQ);
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'F':
+			{
+				int percent = atoi(optarg);
+
+				if(percent < FEED_OVERRIDE_MIN || percent > FEED_OVERRIDE_MAX)
+				{
+					printf("\nERROR: Feed override must be between %d and %d percent\n", FEED_OVERRIDE_MIN, FEED_OVERRIDE_MAX);
+					exit(EXIT_FAILURE);
+				}
+
+				feed_override_set(percent);
+				break;
+			}
+
+			case 'S':
+				STOP_DECEL = atoi(optarg);
+
+				if(STOP_DECEL <= 0 || STOP_DECEL > 125000)
+				{
+					printf("\nERROR: Stop deceleration cannot be less than or equal to 0 or greater than 125000\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'T':
+				if(accel_curve_load(optarg) != 0)
+				{
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'R':
+				if(resonance_load(optarg) != 0)
+				{
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'k':
+				strlcpy(PLAN_CACHE_PATH, optarg, sizeof(PLAN_CACHE_PATH));
+				break;
+
+			case 'K':
+			{
+				int entries = atoi(optarg);
+
+				if(entries <= 0 || entries > 1024)
+				{
+					printf("\nERROR: Plan cache size must be between 1 and 1024 moves\n");
+					exit(EXIT_FAILURE);
+				}
+
+				PLAN_CACHE_ENTRIES = entries;
+				break;
+			}
+
+			case 'l':
+				strlcpy(POSITION_FILE_PATH, optarg, sizeof(POSITION_FILE_PATH));
+				break;
+
+			case 'L':
+				new_position = atoll(optarg);
+				set_position = true;
+				break;
+
+			case 'A':
+				target = atoll(optarg);
+				absolute = true;
+				break;
+
+			case 'H':
+				WIRINGPI_HOME_INPUT = atoi(optarg);
+
+				if(WIRINGPI_HOME_INPUT < 0 || WIRINGPI_HOME_INPUT >= 26)
+				{
+					printf("\nERROR: You must specify a valid WiringPi input for the home switch\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'j':
+				HOME_SPEED = atoi(optarg);
+
+				if(HOME_SPEED <= 0 || HOME_SPEED > 500)
+				{
+					printf("\nERROR: Homing approach speed cannot be less than or equal to 0 or greater than 500 steps/s\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'u':
+				HOME_BACKOFF_STEPS = atoi(optarg);
+
+				if(HOME_BACKOFF_STEPS <= 0)
+				{
+					printf("\nERROR: Homing back-off cannot be less than or equal to 0\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'U':
+				HOME_LATENCY_US = atoi(optarg);
+
+				if(HOME_LATENCY_US < 0)
+				{
+					printf("\nERROR: Home switch latency cannot be negative\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'w':
+			{
+				char shape[8] = {0};
+				int n = sscanf(optarg, "%lf,%lf,%7s", &sweep.f_start, &sweep.f_end, shape);
+
+				if(n < 2 || sweep.f_start < 1 || sweep.f_end < 1 || sweep.f_start > MAX_FREQ || sweep.f_end > MAX_FREQ || (n == 3 && strcmp(shape, "lin") != 0 && strcmp(shape, "log") != 0))
+				{
+					fprintf(stderr, "\nERROR: A sweep is given as start,end[,lin|log] in Hz, between 1 and %dHz\n", MAX_FREQ);
+					exit(EXIT_FAILURE);
+				}
+
+				sweep.log = (n == 3 && strcmp(shape, "log") == 0);
+				sweep_flag = true;
+				break;
+			}
+
+			case 'W':
+				sweep.duration = atof(optarg);
+
+				if(sweep.duration <= 0)
+				{
+					printf("\nERROR: Sweep duration cannot be less than or equal to 0\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'D':
+				sweep.dwell = atoi(optarg);
+
+				if(sweep.dwell < 0)
+				{
+					printf("\nERROR: Sweep dwell cannot be negative\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'M':
+			{
+				char kind[8] = {0};
+				int a = -1;
+				int b = -1;
+
+				if(sscanf(optarg, "%7[a-z]:%d,%d", kind, &a, &b) != 3 || (strcmp(kind, "enc") != 0 && strcmp(kind, "step") != 0) || a < 0 || a >= 26 || b < 0 || b >= 26 || a == b)
+				{
+					printf("\nERROR: The master is given as enc:A,B or step:STEP,DIR with two different valid WiringPi inputs\n");
+					exit(EXIT_FAILURE);
+				}
+
+				MASTER_STEP_DIR = (strcmp(kind, "step") == 0);
+				WIRINGPI_MASTER_A_INPUT = a;
+				WIRINGPI_MASTER_B_INPUT = b;
+				break;
+			}
+
+			case 'G':
+			{
+				int num = 0;
+				int den = 0;
+
+				if(sscanf(optarg, "%d:%d", &num, &den) != 2 || num == 0 || gearing_set_ratio(num, den) != 0)
+				{
+					printf("\nERROR: The gear ratio is given as num:den, slave steps per master count, with neither being 0\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+			}
+
+			case 'C':
+				if(cam_load(optarg) != 0)
+				{
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'J':
+				jog_flag = true;
+				break;
+
+			case 'E':
+				if(rt_sched_parse(optarg) != 0)
+				{
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'N':
+				TIMERFD_SLEEP = true;
+				break;
+
+			case 'X':
+			{
+				int timeout = 0;
+				int cpu = -1;
+
+				if(sscanf(optarg, "%d,%d", &timeout, &cpu) < 1 || timeout <= 0 || cpu < -1)
+				{
+					printf("\nERROR: The watchdog needs a timeout in us greater than 0, and optionally a core, as timeout[,cpu]\n");
+					exit(EXIT_FAILURE);
+				}
+
+				WATCHDOG_TIMEOUT_US = timeout;
+				WATCHDOG_CPU = cpu;
+				break;
+			}
+
 			case 'q':
 			{
 				NO_MOTOR = true;
 				break;
 			}
 
+			case 'I':
+				PERF_COUNTERS = true;
+				break;
+
 			case 'y':
 				VERBOSE = true;
 				break;
@@ -292,26 +657,315 @@ void parse_args(int argc, char **argv)
 	pullUpDnControl(WIRINGPI_DIRECTION_OUTPUT, PUD_DOWN);
 	pullUpDnControl(WIRINGPI_ESTOP_INPUT, PUD_DOWN);
 
+	/* declare ourselves as a realtime task and set the scheduler, sized for the fastest step rate of the run */
+	double step_rate = (mp.velocity > freq) ? mp.velocity : freq;
+
+	if(sweep_flag == true)
+	{
+		step_rate = (sweep.f_start > sweep.f_end) ? sweep.f_start : sweep.f_end;
+	}
+
+	trace_span_begin(trace_span_rt_scheduler);
+
+	if(rt_sched_apply(step_rate) != 0 || (TIMERFD_SLEEP == true && timebase_use_timerfd() != 0))
+	{
+		exit(EXIT_FAILURE);
+	}
+
+	trace_span_end(trace_span_rt_scheduler);
+
+	if(TRACE_FILE_PATH[0] == 0)
+	{
+		trace_setup_end();
+	}
+
+	/* the watchdog thread is started from the pulse loop thread, so that it can move the loop off its core */
+	if(WATCHDOG_TIMEOUT_US > 0 && watchdog_init(WATCHDOG_TIMEOUT_US, WATCHDOG_CPU) != 0)
+	{
+		exit(EXIT_FAILURE);
+	}
+
+	if(stop_request_init() != 0 || feed_override_init() != 0)
+	{
+		exit(EXIT_FAILURE);
+	}
+
+	if(TELEMETRY_SHM_NAME[0] != 0 && telemetry_init(TELEMETRY_SHM_NAME) != 0)
+	{
+		exit(EXIT_FAILURE);
+	}
+
+	if(TRACE_FILE_PATH[0] != 0 && trace_init(TRACE_FILE_PATH, TRACE_FILE_SIZE_MB) != 0)
+	{
+		exit(EXIT_FAILURE);
+	}
+
+	if(PLAN_CACHE_PATH[0] != 0 && plan_cache_init(PLAN_CACHE_PATH, PLAN_CACHE_ENTRIES) != 0)
+	{
+		exit(EXIT_FAILURE);
+	}
+
+	/* the counters are opened on this thread - it is the one that runs the pulse loop */
+	if(PERF_COUNTERS == true && perf_counters_init() != 0)
+	{
+		exit(EXIT_FAILURE);
+	}
+
+	if(POSITION_FILE_PATH[0] != 0 && position_init(POSITION_FILE_PATH) != 0)
+	{
+		exit(EXIT_FAILURE);
+	}
+
+	if((set_position == true || absolute == true) && position_active() == false)
+	{
+		printf("\nERROR: Setting the position (-L) or moving to an absolute position (-A) requires a position file (-l)\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* while homing, -L is the position of the home switch instead */
+	if(set_position == true && WIRINGPI_HOME_INPUT < 0)
+	{
+		position_set(new_position);
+		printf("\nPosition set to %" PRId64 " steps\n", new_position);
+
+		/* -L on its own just sets the position */
+		if(absolute == false && pulse_flag == 0 && mp.num_steps == -1)
+		{
+			exit(EXIT_SUCCESS);
+		}
+	}
+
+	/* an absolute target is turned into a relative move from where the axis is now */
+	if(absolute == true)
+	{
+		if(pulse_flag == 1 || WIRINGPI_HOME_INPUT >= 0 || jog_flag == true || sweep_flag == true || WIRINGPI_MASTER_A_INPUT >= 0)
+		{
+			printf("\nERROR: An absolute position (-A) can't be used with a pulse train (-t), a sweep (-w), homing (-H), jogging (-J) or following (-M)\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if(position_valid() == false)
+		{
+			printf("\nERROR: The axis position is unknown - set it with -L (or home the axis) before an absolute move\n");
+			exit(EXIT_FAILURE);
+		}
+
+		mp.num_steps = target - position_get();
+
+		if(mp.num_steps == 0)
+		{
+			printf("\nAlready at %" PRId64 " steps\n", target);
+			exit(EXIT_SUCCESS);
+		}
+
+		mp.CW = (mp.num_steps > 0);
+		mp.CCW = (mp.num_steps < 0);
+	}
+
+	/* encoder feedback is optional - the following error check only runs if both encoder inputs were given */
+	if(WIRINGPI_ENCODER_A_INPUT >= 0)
+	{
+		if(encoder_init() != 0)
+		{
+			exit(EXIT_FAILURE);
+		}
+	}
+	else if(FOLLOWING_ERROR_LIMIT > 0)
+	{
+		printf("\nERROR: A following error limit (-f) requires encoder inputs (-e)\n");
+		exit(EXIT_FAILURE);
+	}
+
 	/**
 	 * direction logic is set here - go ahead and turn on the output
-	 * for the AMCI SD7540, a HIGH output is CW
+	 * for the AMCI SD7540, a HIGH output is CW. a replay sets it from the trace instead
 	 **/
  
- 	if(mp.CW == 1)
+ 	if(mp.CW == 1 && replay_path[0] == 0)
 	{
 		digitalWrite(WIRINGPI_DIRECTION_OUTPUT, 1);
+		trace_direction(1);
 	}
  
- 	if(mp.CCW == 1)
+ 	if(mp.CCW == 1 && replay_path[0] == 0)
  	{
 		digitalWrite(WIRINGPI_DIRECTION_OUTPUT, 0);
+		trace_direction(0);
 	}
 
 	/**
-	 * check which mode we are using - just a pulse train output, or an actual move profile. act accordingly
+	 * check which mode we are using - homing, just a pulse train output, or an actual move profile. act accordingly
 	 **/
 
-	if(pulse_flag == 1)
+	if(replay_path[0] != 0)
+	{
+		struct replay replay;
+		uint64_t motor_pos = 0;
+
+		if(pulse_flag == 1 || sweep_flag == true || jog_flag == true || WIRINGPI_HOME_INPUT >= 0 || WIRINGPI_MASTER_A_INPUT >= 0)
+		{
+			printf("\nERROR: A replay (-Z) can't be used with -t, -w, -J, -H or -M\n");
+			exit(EXIT_FAILURE);
+		}
+
+		/* the trace of the replay itself would truncate the file being replayed */
+		if(strcmp(replay_path, TRACE_FILE_PATH) == 0)
+		{
+			printf("\nERROR: Record the replay (-b) to a different file than the trace being replayed\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if(replay_open(replay_path, &replay) != 0)
+		{
+			exit(EXIT_FAILURE);
+		}
+
+		/* the trace's own direction records win. -n only gives the direction of the steps before the first one */
+		int8_t direction = (replay.direction >= 0) ? ((replay.direction != 0) ? 1 : -1) : ((mp.CCW == 1) ? -1 : 1);
+
+		/* the encoder checks the steps issued against one direction */
+		if(WIRINGPI_ENCODER_A_INPUT >= 0 && replay.reverses == true)
+		{
+			printf("\nERROR: The trace reverses direction, it can't be replayed with an encoder (-e)\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if(WIRINGPI_ENCODER_A_INPUT >= 0)
+		{
+			encoder_track(&motor_pos, direction, mp.steps_per_rev);
+		}
+
+		telemetry_publish_move(direction);
+		pulse_reset_overruns();
+
+		if(STOP_DECEL == 0 && mp.dec > 0)
+		{
+			STOP_DECEL = mp.dec;
+		}
+
+		position_move_begin();
+		int8_t ret = pulse_replay(&replay, &motor_pos, direction);
+		position_move_end((replay.position < 0) ? -1 : 1, (uint64_t)llabs(replay.position));
+		pulse_print_overruns();
+		perf_counters_print();
+		replay_close(&replay);
+
+		if(ret != 0)
+		{
+			printf("\nERROR: Error in replay execution, exiting...\n");
+			exit(EXIT_FAILURE);
+		}
+
+		fprintf(stderr, "\nReplay Complete (moved %" PRIu64 " steps)\n", motor_pos);
+		exit(EXIT_SUCCESS);
+	}
+	else if(WIRINGPI_HOME_INPUT >= 0)
+	{
+		if(pulse_flag == 1 || mp.starting_speed == -1 || mp.acc == -1 || mp.dec == -1 || mp.velocity == -1 || mp.num_steps == -1)
+		{
+			printf("\nERROR: Homing (-H) needs -s, -a, -d, -v for the seek and -n for the direction and the longest seek\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if(homing_init(WIRINGPI_HOME_INPUT) != 0 || homing_run(&mp, (set_position == true) ? new_position : 0) != 0)
+		{
+			exit(EXIT_FAILURE);
+		}
+
+		exit(EXIT_SUCCESS);
+	}
+	else if(WIRINGPI_MASTER_A_INPUT >= 0)
+	{
+		if(pulse_flag == 1 || sweep_flag == true || jog_flag == true || mp.starting_speed == -1 || mp.acc == -1 || mp.dec == -1 || mp.velocity == -1)
+		{
+			printf("\nERROR: Following a master (-M) needs -s, -a, -d and -v as limits for this axis, and can't be used with -t, -w or -J\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if(gearing_init() != 0 || follow(mp) != 0)
+		{
+			printf("\nERROR: Error while following the master, exiting...\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if(position_active() == true)
+		{
+			printf("\nAbsolute position (steps):\t%" PRId64 "%s\n", position_get(), (position_valid() == true) ? "" : " (origin not set)");
+		}
+
+		exit(EXIT_SUCCESS);
+	}
+	else if(sweep_flag == true)
+	{
+		struct step_schedule schedule;
+		uint64_t motor_pos = 0;
+
+		/* the sweep runs for -W seconds, or -n steps (the sign of -n is the direction) */
+		sweep.steps = (mp.num_steps < 0) ? -mp.num_steps : mp.num_steps;
+
+		if(pulse_flag == 1 || jog_flag == true || (sweep.duration <= 0 && mp.CW == 0 && mp.CCW == 0))
+		{
+			printf("\nERROR: A sweep (-w) needs a duration (-W) or a number of steps (-n), and can't be used with -t or -J\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if(plan_sweep(&sweep, &schedule) != 0)
+		{
+			printf("\nERROR: Could not plan the sweep\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if(WIRINGPI_ENCODER_A_INPUT >= 0)
+		{
+			encoder_track(&motor_pos, (mp.CCW == 1) ? -1 : 1, mp.steps_per_rev);
+		}
+
+		telemetry_publish_move((mp.CCW == 1) ? -1 : 1);
+		pulse_reset_overruns();
+
+		if(STOP_DECEL == 0 && mp.dec > 0)
+		{
+			STOP_DECEL = mp.dec;
+		}
+
+		position_move_begin();
+		int8_t ret = pulse_sweep(&sweep, &schedule, &motor_pos);
+		position_move_end((mp.CCW == 1) ? -1 : 1, motor_pos);
+		pulse_print_overruns();
+		perf_counters_print();
+		schedule_free(&schedule);
+
+		if(ret != 0)
+		{
+			printf("\nERROR: Error in sweep execution, exiting...\n");
+			exit(EXIT_FAILURE);
+		}
+
+		fprintf(stderr, "\nSweep Complete (moved %" PRIu64 " steps)\n", motor_pos);
+		exit(EXIT_SUCCESS);
+	}
+	else if(jog_flag == true)
+	{
+		if(pulse_flag == 1 || mp.starting_speed == -1 || mp.acc == -1 || mp.dec == -1 || mp.velocity == -1)
+		{
+			printf("\nERROR: Jogging (-J) needs -s, -a, -d and -v (the fastest jog) and can't be used with a pulse train (-t)\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if(jog_init(mp.velocity) != 0 || jog(mp) != 0)
+		{
+			printf("\nERROR: Error while jogging, exiting...\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if(position_active() == true)
+		{
+			printf("\nAbsolute position (steps):\t%" PRId64 "%s\n", position_get(), (position_valid() == true) ? "" : " (origin not set)");
+		}
+
+		exit(EXIT_SUCCESS);
+	}
+	else if(pulse_flag == 1)
 	{
 		/* variable that holds the motor position */
 		uint64_t motor_pos = 0;
@@ -323,7 +977,27 @@ void parse_args(int argc, char **argv)
 			num_steps = &mp.num_steps;
 		}
 
-		if(pulse_train(freq, num_steps, &motor_pos) != 0)
+		if(WIRINGPI_ENCODER_A_INPUT >= 0)
+		{
+			encoder_track(&motor_pos, (mp.CCW == 1) ? -1 : 1, mp.steps_per_rev);
+		}
+
+		telemetry_publish_move((mp.CCW == 1) ? -1 : 1);
+		pulse_reset_overruns();
+
+		/* pulse train mode has no move to take a deceleration from, but -d still works for Ctrl-C stops */
+		if(STOP_DECEL == 0 && mp.dec > 0)
+		{
+			STOP_DECEL = mp.dec;
+		}
+
+		position_move_begin();
+		int8_t ret = pulse_train(freq, num_steps, &motor_pos);
+		position_move_end((mp.CCW == 1) ? -1 : 1, motor_pos);
+		pulse_print_overruns();
+		perf_counters_print();
+
+		if(ret != 0)
 		{
 			printf("\nERROR: Error in pulse train execution, exiting...\n");
 			exit(EXIT_FAILURE);
@@ -336,11 +1010,16 @@ void parse_args(int argc, char **argv)
 	}
 	else
 	{
-		if(mp.starting_speed == -1 || mp.steps_per_rev == -1 || mp.acc == -1 || mp.dec == -1 || mp.velocity == -1 || mp.num_steps == -1)
+		if(mp.starting_speed == -1 || mp.steps_per_rev == -1 || mp.acc == -1 || mp.dec == -1 || mp.velocity == -1 || (mp.num_steps == -1 && absolute == false))
 		{
 			printf("Missing argument!\n");
 			show_usage();
 		}
+		else if(move_params_check(&mp) != NULL)
+		{
+			printf("\nERROR: Invalid move: %s\n", move_params_check(&mp));
+			exit(EXIT_FAILURE);
+		}
 		else
 		{
 			/* error messages are printed by execute_move() */
@@ -350,6 +1029,11 @@ void parse_args(int argc, char **argv)
 			}
 			else
 			{
+				if(position_active() == true)
+				{
+					printf("\nAbsolute position (steps):\t%" PRId64 "%s\n", position_get(), (position_valid() == true) ? "" : " (origin not set)");
+				}
+
 				printf("Motion Complete!\n");
 				exit(EXIT_SUCCESS);
 			}
@@ -410,19 +1094,52 @@ void show_usage()
 	printf("-z: wiringpi step direction output number (default 26)\n");
 	printf("-x: wiringpi E-Stop input number (default 0)\n");
 	printf("-y: turns on verbose output\n");
+	printf("-I: counts cycles, instructions, cache misses, context switches and page faults (perf_event_open) per move phase and per pulse loop edge, and prints them after the move\n");
+	printf("-E: realtime scheduler of the pulse loop: fifo[:priority] (default, priority 85) or deadline[:runtime_us:period_us], a SCHED_DEADLINE reservation sized from the step rate unless given\n");
+	printf("-N: sleeps between edges on a timerfd instead of clock_nanosleep\n");
+	printf("-X: pulse loop watchdog as timeout_us[,cpu]. Forces the pulse output low and fails the move if the loop is more than timeout_us late, checked from its own core (default the last)\n");
 	printf("-o: outputs motion profile to <filename>\n");
 	printf("-q: does NOT actually run the motor, just simulates the run. Useful to use with -o if you want to graph the motion profile.\n");
+	printf("-m: publishes live axis telemetry to the POSIX shared memory segment <name> (e.g. /rhubarb_motion)\n");
+	printf("-b: records a binary trace of every edge, state change and pulse loop call, and of the RT setup, to <filename>. Convert it with rhubarb_trace\n");
+	printf("-B: size to preallocate for the binary trace in MB (default 64, ~4 bytes per edge)\n");
+	printf("-p: what to do when the pulse loop wakes up late: catchup (default), reanchor or abort\n");
+	printf("-P: fastest pulse frequency in Hz used to catch up after a late wakeup with -p catchup (default 30000)\n");
+	printf("-F: feed override in percent of -v (10-150, default 100). Send SIGUSR1/SIGUSR2 during a move to raise/lower it by 10%%\n");
+	printf("-S: deceleration in steps/s^2 used to stop on Ctrl-C or SIGTERM (default: -d). Press Ctrl-C twice to stop at once\n");
+	printf("-e: wiringpi encoder inputs as A,B (enables closed loop feedback)\n");
+	printf("-c: encoder counts per revolution, after quadrature decoding (default 4000)\n");
+	printf("-f: following error limit in steps. The move stops if the encoder falls further behind than this (0 disables, default)\n");
 	printf("\n");
 	printf("-s: starting speed in steps/s (1-500)\n");
 	printf("-r: drive steps per revolution (default 2000)\n");
 	printf("-a: acceleration in steps/s^2 (1-1000)\n");
 	printf("-d: deceleration in steps/s^2 (1-1000)\n");
+	printf("-T: acceleration vs speed curve for the motor, one \"speed acceleration\" pair per line. Limits acc and dec at each speed, with -a/-d as upper limits\n");
+	printf("-R: resonance bands for the axis, one \"low high [acceleration]\" band in steps/s per line. Moves never cruise inside a band and cross it at its acceleration\n");
+	printf("-k: keeps planned moves in the cache file <filename>, so repeated moves start without planning\n");
+	printf("-K: number of moves the plan cache holds, least recently used moves are replaced (1-1024, default 64)\n");
+	printf("-l: keeps the absolute axis position in <filename> between runs\n");
+	printf("-L: sets the current absolute position in steps (needs -l). On its own, just sets it without moving\n");
+	printf("-A: moves to an absolute position in steps instead of -n (needs -l and a known position)\n");
+	printf("-H: homes the axis to the home switch on this wiringpi input: a fast seek with -s/-a/-d/-v for at most -n steps (the sign of -n is the direction), a back-off and a slow re-approach\n");
+	printf("-j: homing re-approach speed in steps/s (1-500, default -s)\n");
+	printf("-u: homing back-off past the switch in steps (default 100)\n");
+	printf("-U: home switch interrupt latency in us, compensated for in the captured position (default 0)\n");
 	printf("-v: velocity in steps/s (not to exceed 20kHz pulse frequency)\n");
 	printf("-n: move distance in steps (negative values for CCW rotation, positive values for CW rotation)\n");
 	printf("\n");
 	printf("\n");
 	printf("Special Functions:\n");
 	printf("-t: Create pulse train at specified frequency in Hz. Can be used with -n to specify number of steps to pulse\n");
+	printf("-w: frequency sweep for finding resonances, given as start,end[,lin|log] in Hz. Runs for -W seconds or -n steps, recorded with -b/-m like any move\n");
+	printf("-W: sweep duration in seconds\n");
+	printf("-D: holds each sweep frequency for this many steps, a staircase instead of a continuous chirp (default 0)\n");
+	printf("-M: follow mode. Slaves this axis to a master on two wiringpi inputs, a quadrature encoder (enc:A,B) or another axis's step and direction signals (step:STEP,DIR). -s/-a/-d/-v limit this axis\n");
+	printf("-G: gear ratio for -M as num:den slave steps per master count (default 1:1, a negative num reverses)\n");
+	printf("-C: cam table for -M instead of a ratio, one \"master slave\" point per line with master counts from 0 in equal steps\n");
+	printf("-Z: replays the edges of a trace recorded with -b on the pulse output, at the recorded intervals. The direction output follows the trace too - the sign of -n only sets it for a trace recorded before direction records\n");
+	printf("-J: jog mode. Runs at the velocity read from stdin, one per line in steps/s (negative for CCW, 0 holds, up to -v), ramping with -s/-a/-d. q or the end of the input stops\n");
 	printf("\n");
 	printf("\n");
 	printf("Example: ./rhubarb_motion -s 100 -a 250 -d 250 -v 10 -n 10000 -o profile.csv\n");
@@ -7,36 +7,48 @@
 */
 
 #include <stdint.h>
-#include <assert.h>
 #include <math.h>
 #include <inttypes.h>
 #include <stdlib.h>
-#include <bsd/string.h>
 #include <stdio.h>
 #include <wiringPi.h>
+#include <pthread.h>
 
 #include "motion_control.h"
 #include "globals.h"
 #include "pulse_train.h"
+#include "encoder.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "planner.h"
+#include "plan_cache.h"
+#include "position.h"
+#include "perf_counters.h"
+#include "state_machine.h"
 
 extern _Bool VERBOSE;
 extern int8_t WIRINGPI_DIRECTION_OUTPUT;
+extern int8_t WIRINGPI_ENCODER_A_INPUT;
 
-static uint64_t motor_pos = 0;
-static int64_t acc_stop_point = 0;
-static int64_t dec_start_point = 0;
-static struct move_params *this_move;
+/* per thread, so moves can be estimated side by side on virtual clocks (see timebase.h) */
+static __thread uint64_t motor_pos = 0;
+static __thread int64_t acc_stop_point = 0;
+static __thread int64_t dec_start_point = 0;
+static __thread struct move_params *this_move;
+static __thread struct move_params planned_move;
+static __thread struct step_schedule accel_schedule;
+static __thread struct step_schedule decel_schedule;
 
 /* STATE MACHINE SETUP - STEP 1
- * The next several blocks will setup the state machine.
+ * The next several blocks will setup the state machine for the trapezoid profile (see state_machine.h for the engine).
  *
  * First, we define our states. The states are the actual functions that will be called by the control loop.
  * They take no arguments and return a return code based on whether they fail, pass, or repeat.
  *
  * The state functions defined below define the actual actions in the state (move logic, etc).
- * The do NOT define transition logic - they just return values as defined by state_ret_codes.
+ * The do NOT define transition logic - they just return values as defined by enum sm_ret_codes.
  *
- * The transition logic is defined by lookup_transitions.
+ * The transition logic is defined by the transition table below.
  */
 
 static int state_start(void);
@@ -47,239 +59,138 @@ static int state_estop(void);
 static int state_exit_success(void);
 static int state_exit_fail(void);
 
-/* STATE MACHINE SETUP - STEP 2
- * Next, we setup a function pointer and some variables. 
- * A quick note on function pointers. They are like placholders for actual functions. They define what the function looks like, not what the actual function is.
- * This will make more sense in the command loop in execute_move(). Instead of having a giant if/then/else or switch statement, function pointers allow
- * for a very simple state machine loop as the function pointer can be swapped to represent the different state_* functions
- */
-
-/* Here we define an array of function pointers, along with an enum which gives a name to each index of the array.
- * The defintion arguments NEED to match the names of the state functions declared above
- */
-int (*state[])(void) = {state_start, state_accel, state_run, state_decel, state_estop, state_exit_success, state_exit_fail};
+/* cleanup shared by the states that end a move */
+static void _end_move(void);
 
-/* this enum allows us to refer to the array members above by name, rather than index. For example, state_start == 0, etc
- * These values HAVE to be in sync with the array of function pointers above
+/* STATE MACHINE SETUP - STEP 2
+ * Next, we name the states and point at their functions. The engine swaps between them through these function pointers,
+ * so instead of having a giant if/then/else or switch statement, the control loop in sm_run() stays very simple.
+ *
+ * The array is indexed by enum state_codes (motion_control.h), so these HAVE to be in the same order.
  */
-enum state_codes {start, accel, run, decel, estop, exit_success, exit_fail};
-
-/* set another enum to give us more legible state return codes */
-enum state_ret_codes {done, fail, repeat, stop};
+static const struct sm_state trapezoid_states[] =
+{
+	[STATE_START] = {"start", state_start, false, false},
+	[STATE_ACCEL] = {"accel", state_accel, false, false},
+	[STATE_RUN] = {"run", state_run, false, false},
+	[STATE_DECEL] = {"decel", state_decel, false, false},
+	[STATE_ESTOP] = {"e-stop", state_estop, true, true},
+	[STATE_EXIT_SUCCESS] = {"exit with success", state_exit_success, true, false},
+	[STATE_EXIT_FAIL] = {"exit with fail", state_exit_fail, true, true}
+};
 
 /* STATE MACHINE SETUP - STEP 3
- * This table is very important. This is where all of the possible state transitions are mapped. The template is the "transition" struct -
- * which defines a src state (could be current state), the return code from that state, and then the next state based on the return code
+ * This table is very important. This is where all of the possible state transitions are mapped - a src state (could be current state),
+ * the return code from that state, and then the next state based on the return code. sm_register() turns it into a matrix.
  * 
  * Transitions from the exit and estop states don't need to be defined, because we, well, end.
  *
  * The transition map comes from your state diagram. In the case of this program, the diagram (plotted in GNU Dia), may be found in this Github repository.
  */
-
-struct transition
+static const struct sm_transition trapezoid_transitions[] =
 {
-	enum state_codes src_state;
-	enum state_ret_codes ret_code;
-	enum state_codes dst_state;
+	{STATE_START, sm_done, STATE_ACCEL},
+	{STATE_START, sm_fail, STATE_EXIT_FAIL},
+	{STATE_START, sm_repeat, STATE_START},
+	{STATE_START, sm_stop, STATE_ESTOP},
+
+	{STATE_ACCEL, sm_done, STATE_RUN},
+	{STATE_ACCEL, sm_fail, STATE_EXIT_FAIL},
+	{STATE_ACCEL, sm_repeat, STATE_ACCEL},
+	{STATE_ACCEL, sm_stop, STATE_ESTOP},
+
+	{STATE_RUN, sm_done, STATE_DECEL},
+	{STATE_RUN, sm_fail, STATE_EXIT_FAIL},
+	{STATE_RUN, sm_repeat, STATE_RUN},
+	{STATE_RUN, sm_stop, STATE_ESTOP},
+
+	{STATE_DECEL, sm_done, STATE_EXIT_SUCCESS},
+	{STATE_DECEL, sm_fail, STATE_EXIT_FAIL},
+	{STATE_DECEL, sm_repeat, STATE_DECEL},
+	{STATE_DECEL, sm_stop, STATE_ESTOP}
 };
 
-static struct transition state_transitions[] =
-{
-	{start, done, accel},
-	{start, fail, exit_fail},
-	{start, repeat, start},
-	{start, stop, estop},
-
-	{accel, done, run},
-	{accel, fail, exit_fail},
-	{accel, repeat, accel},
-	{accel, stop, estop},
-
-	{run, done, decel},
-	{run, fail, exit_fail},
-	{run, repeat, run},
-	{run, stop, estop},
-
-	{decel, done, exit_success},
-	{decel, fail, exit_fail},
-	{decel, repeat, decel},
-	{decel, stop, estop}
-};
+static struct sm_profile trapezoid = {"trapezoid", trapezoid_states, sizeof(trapezoid_states) / sizeof(trapezoid_states[0]), STATE_START, true};
+static pthread_once_t trapezoid_once = PTHREAD_ONCE_INIT;
 
-/* Transition lookup routine */
-static enum state_codes lookup_transitions(enum state_codes cs, enum state_ret_codes rc);
-
-int execute_move(struct move_params *mp)
+static void _register_trapezoid(void)
 {
-	/*
-	 * when first entering the move, set current state to state_start and init all variables
-	 *
-	 * current_state = the state the machine is currently in
-	 * rc = return code variables
-	 * m_state = function pointer that can be assigned to any of the state_* functions
-	 *
-	 */
-	
-	this_move = mp;
-	acc_stop_point = pow(this_move->velocity, 2)/(2 * this_move->acc);
-	dec_start_point = this_move->num_steps - (pow(this_move->velocity, 2)/(2 * this_move->dec));
-
-	if(VERBOSE == true)
+	if(sm_register(&trapezoid, trapezoid_transitions, sizeof(trapezoid_transitions) / sizeof(trapezoid_transitions[0])) != 0)
 	{
-		printf("\nMOVE STATISTICS - Trapezoidal Move:\n");
-		printf("Total number of steps:\t\t\t%" PRId64 "\n", this_move->num_steps);
-		printf("Acceleration stop point (steps):\t%" PRId64 "\n", acc_stop_point);
-		printf("Deceleration start point (steps):\t%" PRId64 "\n", dec_start_point);
+		abort();
 	}
+}
 
+int execute_move(struct move_params *mp)
+{
 	/**
-	 * SPECIAL CASE - Acceleration stop point is past halfway point of move
-	 * Create a triangle move in this case, with an equal acc and dec
-	 * 
-	 * To make this move work, we have to figure out our original time to complete the move
-	 * (Vo/a = To), and then use the original time divided by two (To/2) (since this is a triangle move)
-	 * to calculate our new velocity:
-	 * Vnew = a * (To/2)
+	 * plan the move. The planner works in absolute steps, so the phases below run on a copy of the move
+	 * with a positive num_steps and the velocity the plan actually reaches (lower than requested for a triangle move).
+	 * Direction is still carried by CW/CCW.
 	 **/
-	if(acc_stop_point >= this_move->num_steps * 0.5)
-	{
-		acc_stop_point = this_move->num_steps * 0.5;
-		dec_start_point = (this_move->num_steps * 0.5);
-
-		double new_v = sqrt(2*this_move->acc * (this_move->num_steps/2));
-		mp->velocity = new_v;
+	struct move_plan plan;
 
-		printf("\nHalf Way Rule!\n");
-		printf("acc stop: %" PRId64 "\n", acc_stop_point);
-		printf("dec start: %" PRId64 "\n", dec_start_point);
-		printf("new velocity: %F\n", mp->velocity);
-	}
+	/**
+	 * the ramps are planned step by step up front, using the acceleration curve if one was given (-T).
+	 * A move that is in the plan cache (-k) skips the planning entirely
+	 **/
+	trace_span_begin(trace_span_plan);
+	_Bool cache_hit = (plan_cache_lookup(mp, &plan, &accel_schedule, &decel_schedule) == 0);
 
-	enum state_codes current_state = start;
-	enum state_ret_codes rc;
-	int (*m_state)(void);
-
-	/* this is the main control loop for the state machine 
-	 *	
-	 *	Thanks to using function pointers, the state machine is quite straightforward. 
-	 *	Essentially, m_state is set to point to the current state's state_* function.
-	 *	Then, the return code generated by the execution of the appropriate state function is stored in rc.
-	 *	Based on the code stored in rc (done, fail, estop, etc), move forward, or don't if it is an exit state or estop state
-	 *
-	 *	All the while, the called functions (state_start, state_accel, state_decel) are setting the pulse interval,
-	 *	which is being executed here.
-	 */
-	for(;;)
+	if(cache_hit == false)
 	{
-		m_state = state[current_state];
-		rc = m_state();
-		
-		/* setup some conditionals. if in an exit state or estop state, break the loop and exit.
-		 * otherwise, call the lookup function to find the next state
-		 */
-		if(current_state == exit_success)
+		if(plan_schedules(mp, &plan, &accel_schedule, &decel_schedule) != 0)
 		{
-			break;
-		}
-
-		if(current_state == exit_fail)
-		{
-			/* the calling function should print an error message */
-			return EXIT_FAILURE;
-		}
-
-		if(current_state == estop)
-		{
-			/* the calling function should print an error message */
+			printf("\nERROR: Could not plan move\n");
 			return EXIT_FAILURE;
 		}
 
-		/* if we made it past the conditionals, call the state transition lookup and proceed! */
-		current_state = lookup_transitions(current_state, rc);
+		plan_cache_store(mp, &plan, &accel_schedule, &decel_schedule);
 	}
 
-	/* get here only if we break the for loop due to getting to state_exit_success */
-	return EXIT_SUCCESS;
-}
+	trace_span_end(trace_span_plan);
 
-static enum state_codes lookup_transitions(enum state_codes cs, enum state_ret_codes rc)
-{
-	/*
-	 * loop through the array state_transitions and find our current state, cs, and the return code.
-	 * fetch the next value in the sub array and return the next state code
-	 */
+	planned_move = *mp;
+	planned_move.num_steps = plan.distance;
+	planned_move.velocity = plan.v_peak;
 
-	enum state_codes ret_state;
-	int8_t i = 0;
-	int8_t found = 0;
-
-	for(i=0; i < (sizeof(state_transitions) / sizeof(state_transitions[0])); i++)
-	{
-		struct transition *t = &state_transitions[i];
-		
-		if(t->src_state == cs && t->ret_code == rc)
-		{
-			ret_state = t->dst_state;
-			found = 1;
-		}
-	}
+	this_move = &planned_move;
+	acc_stop_point = plan.acc_stop_point;
+	dec_start_point = plan.dec_start_point;
 
-	/* assert that we found a valid state. if not, something is very wrong and we should abort */
-	assert(found == 1);
-	
-	/* also throw in a debug message about a state change */
 	if(VERBOSE == true)
 	{
-		if(ret_state != cs)
+		plan_print(&plan);
+
+		if(plan_cache_active() == true)
 		{
-			char state_name[100] = {0};
-
-			switch(ret_state)
-			{
-				case start:
-					strlcpy(state_name, "start", sizeof(state_name));
-					break;
-
-				case accel:
-					strlcpy(state_name, "accel", sizeof(state_name));
-					break;
-
-				case run:
-					strlcpy(state_name, "run", sizeof(state_name));
-					break;
-
-				case decel:
-					strlcpy(state_name, "decel", sizeof(state_name));
-					break;
-
-				case estop:
-					strlcpy(state_name, "e-stop", sizeof(state_name));
-					break;
-
-				case exit_success:
-					strlcpy(state_name, "exit with success", sizeof(state_name));
-					break;
-
-				case exit_fail:
-					strlcpy(state_name, "exit with fail", sizeof(state_name));
-					break;
-				
-				default:
-					strlcpy(state_name, "unknown", sizeof(state_name));
-					break;
-			}
-
-			fprintf(stderr, "\nTransitioning to state: %s\n", state_name);
+			printf("Plan cache:\t\t\t\t%s\n", (cache_hit == true) ? "hit" : "miss");
 		}
 	}
 
-	return ret_state;
+	/* the position file is written now and when the move ends, never while pulsing */
+	position_move_begin();
+	perf_counters_reset();
+	trace_span_begin(trace_span_move);
+
+	/**
+	 * run the trapezoid profile. the states (start, accel, run, decel) call into the pulse loop, and the
+	 * return code of each picks the next state until an exit or e-stop state has run
+	 **/
+	pthread_once(&trapezoid_once, _register_trapezoid);
+	int ret = sm_run(&trapezoid);
+
+	trace_span_end(trace_span_move);
+	perf_counters_print();
+
+	/* on failure, the calling function should print an error message */
+	return ret;
 }
 
 static int state_start(void)
 {
 	/* default state is success since this is mostly a setup routine*/
-	enum state_ret_codes rc = done;
+	int rc = sm_done;
 	
 	/*
 	 * the starting logic is simple. init the following variables
@@ -287,13 +198,21 @@ static int state_start(void)
 	 */
 
 	motor_pos = 0;
+	pulse_reset_overruns();
+	telemetry_publish_move((this_move->CCW == 1) ? -1 : 1);
+
+	/* if encoder feedback is configured, start comparing the encoder against motor_pos */
+	if(WIRINGPI_ENCODER_A_INPUT >= 0)
+	{
+		encoder_track(&motor_pos, (this_move->CCW == 1) ? -1 : 1, this_move->steps_per_rev);
+	}
 	
 	return rc;
 }
 
 static int state_accel(void)
 {
-	enum state_ret_codes rc;
+	int rc;
 	
 	 /** 
 	  * Calling this function fires a loop in pulse_train.c.
@@ -307,27 +226,32 @@ static int state_accel(void)
 	  * The third parameter, stop_point, is ignored for this move profile!
 	  **/
 	
-	double times[this_move->num_steps];
-	memset(times, 0, this_move->num_steps*sizeof(double));
-
-	uint64_t positions[this_move->num_steps];
-	memset(positions, 0, this_move->num_steps*sizeof(uint64_t));
-
-	int8_t ret = trap_acc_dec(*this_move, acc_stop_point, &motor_pos, times, positions);
+	/* times and positions are not used by trap_acc_dec() - don't put two num_steps long arrays on the stack for them */
+	int8_t ret = trap_acc_dec(*this_move, acc_stop_point, &motor_pos, NULL, NULL, &accel_schedule);
 	
 	if(ret == 0)
 	{
-		rc=done;
+		rc = sm_done;
 	}
 	
 	if(ret == -1)
 	{
-		rc=fail;
+		rc = sm_fail;
 	}
 
 	if(ret == -2)
 	{
-		rc=stop;
+		rc = sm_stop;
+	}
+
+	if(ret == PULSE_ERR_FOLLOWING || ret == PULSE_ERR_OVERRUN || ret == PULSE_ERR_WATCHDOG)
+	{
+		rc = sm_stop;
+	}
+
+	if(ret == PULSE_ERR_STOPPED || ret == PULSE_ERR_HOMED)
+	{
+		rc = sm_fail;
 	}
 
 	return rc;
@@ -335,24 +259,34 @@ static int state_accel(void)
 
 static int state_run(void)
 {
-	enum state_ret_codes rc;
+	int rc;
 
-	int64_t run_dist = dec_start_point - acc_stop_point;
-	int8_t ret = pulse_train(this_move->velocity, &run_dist, &motor_pos);
+	/* dec_start_point is absolute, like motor_pos */
+	int8_t ret = trap_run(*this_move, dec_start_point, &motor_pos);
 
 	if(ret == 0)
 	{
-		rc=done;
+		rc = sm_done;
 	}
 	
 	if(ret == -1)
 	{
-		rc=fail;
+		rc = sm_fail;
 	}
 
 	if(ret == -2)
 	{
-		rc=stop;
+		rc = sm_stop;
+	}
+
+	if(ret == PULSE_ERR_FOLLOWING || ret == PULSE_ERR_OVERRUN || ret == PULSE_ERR_WATCHDOG)
+	{
+		rc = sm_stop;
+	}
+
+	if(ret == PULSE_ERR_STOPPED || ret == PULSE_ERR_HOMED)
+	{
+		rc = sm_fail;
 	}
 
 	return rc;
@@ -360,7 +294,7 @@ static int state_run(void)
 
 static int state_decel(void)
 {
-	enum state_ret_codes rc;
+	int rc;
 
 	/** 
 	  * Calling this function fires a loop in pulse_train.c.
@@ -374,27 +308,32 @@ static int state_decel(void)
 	  * The third parameter, stop_point, is ignored for this move profile!
 	  **/
 	
-	double times[this_move->num_steps];
-	memset(times, 0, this_move->num_steps*sizeof(double));
-
-	uint64_t positions[this_move->num_steps];
-	memset(positions, 0, this_move->num_steps*sizeof(uint64_t));
-
-	int8_t ret = trap_acc_dec(*this_move, this_move->num_steps, &motor_pos, times, positions);
+	/* times and positions are not used by trap_acc_dec() - don't put two num_steps long arrays on the stack for them */
+	int8_t ret = trap_acc_dec(*this_move, this_move->num_steps, &motor_pos, NULL, NULL, &decel_schedule);
 	
 	if(ret == 0)
 	{
-		rc=done;
+		rc = sm_done;
 	}
 	
 	if(ret == -1)
 	{
-		rc=fail;
+		rc = sm_fail;
 	}
 
 	if(ret == -2)
 	{
-		rc=stop;
+		rc = sm_stop;
+	}
+
+	if(ret == PULSE_ERR_FOLLOWING || ret == PULSE_ERR_OVERRUN || ret == PULSE_ERR_WATCHDOG)
+	{
+		rc = sm_stop;
+	}
+
+	if(ret == PULSE_ERR_STOPPED || ret == PULSE_ERR_HOMED)
+	{
+		rc = sm_fail;
 	}
 	
 	return rc;
@@ -402,30 +341,54 @@ static int state_decel(void)
 
 static int state_estop(void)
 {
-	enum state_ret_codes rc;
+	int rc;
 	
 	printf("!!! E-STOP - Stopping Execution!\n");
-	rc = fail;
+	_end_move();
+	rc = sm_fail;
 	return rc;
 }
 
 static int state_exit_success(void)
 {
-	enum state_ret_codes rc;
-	
-	rc = done;
+	int rc;
+
+	if(VERBOSE == true && WIRINGPI_ENCODER_A_INPUT >= 0)
+	{
+		printf("\nEncoder position (counts):\t%" PRId64 "\n", encoder_position());
+		printf("Final following error (steps):\t%" PRId64 "\n", encoder_following_error());
+	}
+
+	_end_move();
+	rc = sm_done;
 	return rc;
 }
 
 /* exact error message should be printed by the caller */
 static int state_exit_fail(void)
 {
-	enum state_ret_codes rc;
+	int rc;
 	
-	rc = fail;
+	_end_move();
+	rc = sm_fail;
 	return rc;
 }
 
+static void _end_move(void)
+{
+	/* motor_pos is what was actually issued, also after a stop or e-stop */
+	position_move_end((this_move->CCW == 1) ? -1 : 1, motor_pos);
+	encoder_untrack();
+	pulse_print_overruns();
+	schedule_free(&accel_schedule);
+	schedule_free(&decel_schedule);
+}
+
+const uint64_t *move_position(void)
+{
+	return &motor_pos;
+}
+
 struct move_params init_move_params()
 {
 	struct move_params m;
@@ -442,6 +405,47 @@ struct move_params init_move_params()
 	return m;
 }
 
+/* the limits parse_args() puts on the command line, for moves that come from anywhere else */
+const char *move_params_check(const struct move_params *mp)
+{
+	if(mp->starting_speed <= 0 || mp->starting_speed > 500)
+	{
+		return "starting speed out of range (1-500)";
+	}
+
+	if(mp->acc <= 0 || mp->acc > 125000)
+	{
+		return "acceleration out of range (1-125000)";
+	}
+
+	if(mp->dec <= 0 || mp->dec > 125000)
+	{
+		return "deceleration out of range (1-125000)";
+	}
+
+	if(mp->velocity <= 0 || mp->velocity > MAX_FREQ)
+	{
+		return "velocity out of range";
+	}
+
+	if(mp->velocity < mp->starting_speed)
+	{
+		return "velocity below the starting speed";
+	}
+
+	if(mp->num_steps == 0 || mp->num_steps > INT32_MAX || mp->num_steps < -INT32_MAX)
+	{
+		return "number of steps out of range";
+	}
+
+	if(mp->steps_per_rev <= 0)
+	{
+		return "steps per rev out of range";
+	}
+
+	return NULL;
+}
+
 inline void tsnorm(struct timespec *ts)
 {
 	while(ts->tv_nsec >= NSEC_PER_SEC)
@@ -24,8 +24,18 @@ struct move_params
 	int32_t steps_per_rev;
 };
 
+/* the move states of the trapezoid profile, in the same order as the trapezoid_states[] table in motion_control.c.
+ * Declared here so that telemetry readers can decode the published state
+ */
+enum state_codes {STATE_START, STATE_ACCEL, STATE_RUN, STATE_DECEL, STATE_ESTOP, STATE_EXIT_SUCCESS, STATE_EXIT_FAIL};
+
 int execute_move(struct move_params *mp);
+
+/* the step counter of the calling thread's move, for code that watches the move from another thread (e.g. an interrupt) */
+const uint64_t *move_position(void);
 struct move_params init_move_params();
+/* NULL if the move is inside the command line limits, otherwise what is out of range */
+const char *move_params_check(const struct move_params *mp);
 inline void tsnorm(struct timespec *ts);
 
 #endif /*MOTION_CONTROL_H*/
@@ -0,0 +1,284 @@
+/*
+*	perf_counters.c
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#define _GNU_SOURCE
+
+#include "perf_counters.h"
+#include "motion_control.h"
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+enum perf_counter {perf_cycles, perf_instructions, perf_cache_misses, perf_context_switches, perf_page_faults, PERF_COUNTER_COUNT};
+
+static const char *COUNTER_NAMES[PERF_COUNTER_COUNT] = {"cycles", "instructions", "cache misses", "context switches", "page faults"};
+
+static const struct
+{
+	uint32_t type;
+	uint64_t config;
+} COUNTER_EVENTS[PERF_COUNTER_COUNT] =
+{
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS}
+};
+
+/* indexed by enum state_codes */
+static const char *PHASE_NAMES[] = {[STATE_START] = "start", [STATE_ACCEL] = "accel", [STATE_RUN] = "run", [STATE_DECEL] = "decel", [STATE_ESTOP] = "e-stop", [STATE_EXIT_SUCCESS] = "exit with success", [STATE_EXIT_FAIL] = "exit with fail"};
+#define PHASE_COUNT ((int32_t)(sizeof(PHASE_NAMES) / sizeof(PHASE_NAMES[0])))
+
+struct perf_sample
+{
+	uint64_t v[PERF_COUNTER_COUNT];
+	int64_t nivcsw;
+	int64_t minflt;
+	int64_t majflt;
+};
+
+static int leader_fd = -1;
+static int32_t opened = 0;
+
+/* where each counter is in the group read, -1 if it could not be opened */
+static int32_t slot[PERF_COUNTER_COUNT];
+
+static struct perf_sample phase_start;
+static struct perf_sample phase_total[PHASE_COUNT];
+static uint64_t phase_runs[PHASE_COUNT];
+
+static struct perf_sample edge_start;
+static struct perf_sample edge_total;
+static uint64_t edges = 0;
+
+static int _open(const uint32_t type, const uint64_t config, const int group_fd)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+	attr.disabled = (group_fd == -1);
+
+	/* this thread only, on whatever CPU it runs */
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+/* one read() for the whole group */
+static inline void _read(struct perf_sample *s)
+{
+	uint64_t buf[1 + PERF_COUNTER_COUNT];
+
+	if(read(leader_fd, buf, sizeof(buf)) < (ssize_t)sizeof(uint64_t))
+	{
+		memset(s->v, 0, sizeof(s->v));
+		return;
+	}
+
+	for(int32_t i = 0; i < PERF_COUNTER_COUNT; i++)
+	{
+		s->v[i] = (slot[i] >= 0 && (uint64_t)slot[i] < buf[0]) ? buf[1 + slot[i]] : 0;
+	}
+}
+
+static inline void _add_delta(struct perf_sample *total, const struct perf_sample *from, const struct perf_sample *to)
+{
+	for(int32_t i = 0; i < PERF_COUNTER_COUNT; i++)
+	{
+		total->v[i] += to->v[i] - from->v[i];
+	}
+
+	total->nivcsw += to->nivcsw - from->nivcsw;
+	total->minflt += to->minflt - from->minflt;
+	total->majflt += to->majflt - from->majflt;
+}
+
+static inline void _rusage(struct perf_sample *s)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_THREAD, &ru);
+	s->nivcsw = ru.ru_nivcsw;
+	s->minflt = ru.ru_minflt;
+	s->majflt = ru.ru_majflt;
+}
+
+int8_t perf_counters_init(void)
+{
+	for(int32_t i = 0; i < PERF_COUNTER_COUNT; i++)
+	{
+		int fd = _open(COUNTER_EVENTS[i].type, COUNTER_EVENTS[i].config, leader_fd);
+		slot[i] = -1;
+
+		if(fd < 0)
+		{
+			continue;
+		}
+
+		if(leader_fd < 0)
+		{
+			leader_fd = fd;
+		}
+
+		slot[i] = opened++;
+	}
+
+	if(leader_fd < 0)
+	{
+		perror("\nERROR: Could not open any performance counters");
+		return -1;
+	}
+
+	perf_counters_reset();
+	ioctl(leader_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+	return 0;
+}
+
+_Bool perf_counters_active(void)
+{
+	return leader_fd >= 0;
+}
+
+void perf_counters_reset(void)
+{
+	if(leader_fd < 0)
+	{
+		return;
+	}
+
+	memset(phase_total, 0, sizeof(phase_total));
+	memset(phase_runs, 0, sizeof(phase_runs));
+	memset(&edge_total, 0, sizeof(edge_total));
+	edges = 0;
+}
+
+void perf_phase_begin(void)
+{
+	if(leader_fd < 0)
+	{
+		return;
+	}
+
+	_rusage(&phase_start);
+	_read(&phase_start);
+}
+
+void perf_phase_end(const int32_t phase)
+{
+	struct perf_sample now;
+
+	if(leader_fd < 0 || phase < 0 || phase >= PHASE_COUNT)
+	{
+		return;
+	}
+
+	_read(&now);
+	_rusage(&now);
+	_add_delta(&phase_total[phase], &phase_start, &now);
+	phase_runs[phase]++;
+}
+
+void perf_edge_begin(void)
+{
+	if(leader_fd < 0)
+	{
+		return;
+	}
+
+	_read(&edge_start);
+}
+
+void perf_edge_end(void)
+{
+	struct perf_sample now;
+
+	if(leader_fd < 0)
+	{
+		return;
+	}
+
+	/* rusage is not sampled per edge - the perf counters see every switch and fault, and there is no sleep to tell apart */
+	_read(&now);
+	now.nivcsw = now.minflt = now.majflt = 0;
+	edge_start.nivcsw = edge_start.minflt = edge_start.majflt = 0;
+	_add_delta(&edge_total, &edge_start, &now);
+	edges++;
+}
+
+static void _print_value(const int32_t counter, const long double value, const int decimals)
+{
+	if(slot[counter] < 0)
+	{
+		printf("%18s", "n/a");
+	}
+	else
+	{
+		printf("%18.*Lf", decimals, value);
+	}
+}
+
+void perf_counters_print(void)
+{
+	if(leader_fd < 0)
+	{
+		return;
+	}
+
+	printf("\nPERFORMANCE COUNTERS (per phase totals):\n");
+	printf("%-18s", "phase");
+
+	for(int32_t i = 0; i < PERF_COUNTER_COUNT; i++)
+	{
+		printf("%18s", COUNTER_NAMES[i]);
+	}
+
+	printf("%18s%18s\n", "invol. switches", "major faults");
+
+	for(int32_t p = 0; p < PHASE_COUNT; p++)
+	{
+		if(phase_runs[p] == 0)
+		{
+			continue;
+		}
+
+		printf("%-18s", PHASE_NAMES[p]);
+
+		for(int32_t i = 0; i < PERF_COUNTER_COUNT; i++)
+		{
+			_print_value(i, phase_total[p].v[i], 0);
+		}
+
+		printf("%18" PRId64 "%18" PRId64 "\n", phase_total[p].nivcsw, phase_total[p].majflt);
+	}
+
+	if(edges == 0)
+	{
+		return;
+	}
+
+	printf("\nPERFORMANCE COUNTERS (per edge averages over %" PRIu64 " edges, wakeup to sleep):\n", edges);
+
+	for(int32_t i = 0; i < PERF_COUNTER_COUNT; i++)
+	{
+		printf("%-18s", COUNTER_NAMES[i]);
+		_print_value(i, (long double)edge_total.v[i] / edges, 2);
+		printf("    (%" PRIu64 " total)\n", edge_total.v[i]);
+	}
+}
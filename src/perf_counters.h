@@ -0,0 +1,48 @@
+/*
+*	perf_counters.h
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdint.h>
+
+/**
+ * HOT PATH PERFORMANCE COUNTERS
+ * With -I, the pulse loop thread opens a group of perf_event_open counters on itself - cycles, instructions, cache misses,
+ * context switches and page faults - and counts them
+ *
+ *	per phase: around each state of execute_move(), together with the involuntary context switches and page faults
+ *	from getrusage(RUSAGE_THREAD), since the phases also sleep between edges (voluntary switches)
+ *	per edge: around the body of the pulse loop, from waking up to going back to sleep
+ *
+ * The per edge numbers are the ones that prove the RT loop is clean: any context switch or page fault in there was not
+ * asked for. Reading the group costs a read() per sample, so -I slows the loop down a little - don't run production
+ * moves with it. Counters the hardware or the kernel can't provide (e.g. the hardware ones in a VM) are reported as n/a.
+ **/
+
+/* opens the counters for the calling thread. returns 0 on success, -1 if none could be opened */
+int8_t perf_counters_init(void);
+
+/* 1 if perf_counters_init() succeeded */
+_Bool perf_counters_active(void);
+
+/* forgets the counts of the last move */
+void perf_counters_reset(void);
+
+/* around one phase of a move, phase is the enum state_codes */
+void perf_phase_begin(void);
+void perf_phase_end(const int32_t phase);
+
+/* around one pass of the pulse loop */
+void perf_edge_begin(void);
+void perf_edge_end(void);
+
+/* prints the per phase totals and the per edge averages */
+void perf_counters_print(void);
+
+#endif /*PERF_COUNTERS_H*/
@@ -0,0 +1,235 @@
+/*
+*	plan_cache.c
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#include "plan_cache.h"
+#include "accel_curve.h"
+#include "resonance.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+static uint8_t *map = NULL;
+static size_t map_size = 0;
+static size_t entry_size = 0;
+static struct plan_cache_header *hdr = NULL;
+
+static inline struct plan_cache_entry *_entry(const uint32_t i)
+{
+	return (struct plan_cache_entry *)(map + sizeof(struct plan_cache_header) + (i * entry_size));
+}
+
+/* the key is compared with memcmp, so it is built field by field over zeroed padding */
+static void _make_key(const struct move_params *mp, struct plan_cache_key *key)
+{
+	memset(key, 0, sizeof(*key));
+	key->mp.CW = mp->CW;
+	key->mp.CCW = mp->CCW;
+	key->mp.starting_speed = mp->starting_speed;
+	key->mp.acc = mp->acc;
+	key->mp.dec = mp->dec;
+	key->mp.velocity = mp->velocity;
+	key->mp.num_steps = mp->num_steps;
+	key->mp.steps_per_rev = mp->steps_per_rev;
+	key->curve = accel_curve_fingerprint();
+	key->bands = resonance_fingerprint();
+}
+
+/* FNV-1a style hash over everything after the checksum field */
+static uint64_t _checksum(const struct plan_cache_entry *e)
+{
+	uint64_t h = 14695981039346656037ULL;
+	const uint8_t *p = (const uint8_t *)&e->key;
+	const uint8_t *end = (const uint8_t *)e->interval_ns;
+
+	while(p < end)
+	{
+		h = (h ^ *p++) * 1099511628211ULL;
+	}
+
+	for(int64_t i = 0; i < e->accel_count + e->decel_count; i++)
+	{
+		h = (h ^ e->interval_ns[i]) * 1099511628211ULL;
+	}
+
+	return h;
+}
+
+int8_t plan_cache_init(const char *path, const uint32_t entries)
+{
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+
+	if(fd < 0)
+	{
+		perror("\nERROR: Could not open plan cache");
+		return -1;
+	}
+
+	if(flock(fd, LOCK_EX | LOCK_NB) < 0)
+	{
+		perror("\nERROR: Could not lock plan cache");
+		close(fd);
+		return -1;
+	}
+
+	/* keep the intervals 8 byte aligned so the entries that follow are too */
+	entry_size = (sizeof(struct plan_cache_entry) + (PLAN_CACHE_MAX_INTERVALS * sizeof(uint32_t)) + 7) & ~(size_t)7;
+	map_size = sizeof(struct plan_cache_header) + (entries * entry_size);
+
+	struct stat st;
+	struct plan_cache_header old;
+	_Bool fresh = true;
+
+	memset(&old, 0, sizeof(old));
+
+	if(fstat(fd, &st) == 0 && (size_t)st.st_size == map_size && pread(fd, &old, sizeof(old), 0) == sizeof(old))
+	{
+		fresh = memcmp(old.magic, PLAN_CACHE_MAGIC, sizeof(old.magic)) != 0 || old.version != PLAN_CACHE_VERSION ||
+				old.planner_version != PLANNER_VERSION || old.entries != entries || old.max_intervals != PLAN_CACHE_MAX_INTERVALS;
+	}
+
+	/* a cache from another planner version or with another layout is thrown away - truncating zeroes every entry */
+	if(fresh == true && (ftruncate(fd, 0) < 0 || ftruncate(fd, map_size) < 0))
+	{
+		perror("\nERROR: Could not size plan cache");
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+
+	/* the lock belongs to the open file, so fd stays open until exit */
+	if(map == MAP_FAILED)
+	{
+		perror("\nERROR: Could not map plan cache");
+		close(fd);
+		map = NULL;
+		return -1;
+	}
+
+	hdr = (struct plan_cache_header *)map;
+
+	if(fresh == true)
+	{
+		memcpy(hdr->magic, PLAN_CACHE_MAGIC, sizeof(hdr->magic));
+		hdr->version = PLAN_CACHE_VERSION;
+		hdr->planner_version = PLANNER_VERSION;
+		hdr->entries = entries;
+		hdr->max_intervals = PLAN_CACHE_MAX_INTERVALS;
+		hdr->clock = 0;
+	}
+
+	return 0;
+}
+
+_Bool plan_cache_active(void)
+{
+	return map != NULL;
+}
+
+int8_t plan_cache_lookup(const struct move_params *mp, struct move_plan *plan, struct step_schedule *accel, struct step_schedule *decel)
+{
+	struct plan_cache_key key;
+
+	if(map == NULL)
+	{
+		return -1;
+	}
+
+	_make_key(mp, &key);
+
+	for(uint32_t i = 0; i < hdr->entries; i++)
+	{
+		struct plan_cache_entry *e = _entry(i);
+
+		if(e->valid == 0 || memcmp(&e->key, &key, sizeof(key)) != 0)
+		{
+			continue;
+		}
+
+		if(e->planner_version != PLANNER_VERSION || e->accel_count < 0 || e->decel_count < 0 ||
+		   e->accel_count + e->decel_count > PLAN_CACHE_MAX_INTERVALS || _checksum(e) != e->checksum)
+		{
+			/* stale or damaged - drop it and plan again */
+			e->valid = 0;
+			return -1;
+		}
+
+		e->last_used = ++hdr->clock;
+
+		*plan = e->plan;
+
+		accel->first_step = e->accel_first_step;
+		accel->count = e->accel_count;
+		accel->interval_ns = e->interval_ns;
+		accel->cached = true;
+
+		decel->first_step = e->decel_first_step;
+		decel->count = e->decel_count;
+		decel->interval_ns = e->interval_ns + e->accel_count;
+		decel->cached = true;
+
+		return 0;
+	}
+
+	return -1;
+}
+
+void plan_cache_store(const struct move_params *mp, const struct move_plan *plan, const struct step_schedule *accel, const struct step_schedule *decel)
+{
+	if(map == NULL || accel->count + decel->count > PLAN_CACHE_MAX_INTERVALS)
+	{
+		return;
+	}
+
+	/* an empty entry if there is one, otherwise the least recently used */
+	struct plan_cache_entry *e = _entry(0);
+
+	for(uint32_t i = 0; i < hdr->entries && e->valid != 0; i++)
+	{
+		struct plan_cache_entry *c = _entry(i);
+
+		if(c->valid == 0 || c->last_used < e->last_used)
+		{
+			e = c;
+		}
+	}
+
+	/* invalid while it is written, so a crash part way through leaves nothing that could be executed */
+	e->valid = 0;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	_make_key(mp, &e->key);
+	e->planner_version = PLANNER_VERSION;
+	e->plan = *plan;
+	e->accel_first_step = accel->first_step;
+	e->accel_count = accel->count;
+	e->decel_first_step = decel->first_step;
+	e->decel_count = decel->count;
+
+	if(accel->count > 0)
+	{
+		memcpy(e->interval_ns, accel->interval_ns, accel->count * sizeof(uint32_t));
+	}
+
+	if(decel->count > 0)
+	{
+		memcpy(e->interval_ns + accel->count, decel->interval_ns, decel->count * sizeof(uint32_t));
+	}
+
+	e->checksum = _checksum(e);
+	e->last_used = ++hdr->clock;
+
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	e->valid = 1;
+}
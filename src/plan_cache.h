@@ -0,0 +1,85 @@
+/*
+*	plan_cache.h
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#ifndef PLAN_CACHE_H
+#define PLAN_CACHE_H
+
+#include <stdint.h>
+
+#include "motion_control.h"
+#include "planner.h"
+
+#define PLAN_CACHE_MAGIC "RHBPLANC"
+#define PLAN_CACHE_VERSION 2
+
+/* the longest accel + decel schedule that is cached, in steps. longer ramps are planned every time */
+#define PLAN_CACHE_MAX_INTERVALS 16384
+
+/**
+ * PLAN CACHE
+ * Planned moves (the plan and both step interval schedules) are kept in a memory mapped file (see -k), so a move
+ * that was run before - even in an earlier run of the program - starts without being planned again.
+ *
+ * Entries are keyed by the full struct move_params and the acceleration curve and resonance bands they were planned with. The file has
+ * a fixed number of fixed size entries, the least recently used one is replaced when the cache is full.
+ * Every entry carries the PLANNER_VERSION it was made with and a checksum. An entry from another planner version or
+ * with a bad checksum (e.g. a torn write) is never executed, and a file from another planner version is cleared when it is opened.
+ *
+ * On a hit the schedules point straight into the mapped file. The file is locked, so only one process uses it at a time.
+ **/
+struct plan_cache_header
+{
+	char magic[8];
+	uint32_t version;			/* PLAN_CACHE_VERSION */
+	uint32_t planner_version;	/* PLANNER_VERSION */
+	uint32_t entries;
+	uint32_t max_intervals;
+	uint64_t clock;				/* bumped on every use, for the LRU */
+};
+
+struct plan_cache_key
+{
+	struct move_params mp;
+	uint64_t curve;				/* accel_curve_fingerprint() */
+	uint64_t bands;				/* resonance_fingerprint() */
+};
+
+struct plan_cache_entry
+{
+	uint32_t valid;
+	uint32_t planner_version;
+	uint64_t last_used;
+	uint64_t checksum;
+
+	struct plan_cache_key key;
+	struct move_plan plan;
+	int64_t accel_first_step;
+	int64_t accel_count;
+	int64_t decel_first_step;
+	int64_t decel_count;
+
+	/* accel_count intervals followed by decel_count intervals */
+	uint32_t interval_ns[];
+};
+
+/* opens (or creates) the cache file with room for the given number of entries. returns 0 on success, -1 on failure */
+int8_t plan_cache_init(const char *path, const uint32_t entries);
+
+/* 1 if plan_cache_init() succeeded */
+_Bool plan_cache_active(void);
+
+/**
+ * Looks mp up. On a hit, fills in plan and points the schedules into the cache and returns 0.
+ * Returns -1 on a miss, or if the cache is not active.
+ **/
+int8_t plan_cache_lookup(const struct move_params *mp, struct move_plan *plan, struct step_schedule *accel, struct step_schedule *decel);
+
+/* stores a plan made by plan_schedules(), replacing the least recently used entry if the cache is full */
+void plan_cache_store(const struct move_params *mp, const struct move_plan *plan, const struct step_schedule *accel, const struct step_schedule *decel);
+
+#endif /*PLAN_CACHE_H*/
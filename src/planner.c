@@ -0,0 +1,389 @@
+/*
+*	planner.c
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#include "planner.h"
+#include "accel_curve.h"
+#include "resonance.h"
+#include "globals.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+int8_t plan_profile(const int64_t num_steps, const double v_start, const double v_end, const double velocity, const double acc, const double dec, struct move_plan *plan)
+{
+	if(acc <= 0 || dec <= 0 || velocity <= 0)
+	{
+		return -1;
+	}
+
+	plan->distance = llabs(num_steps);
+	plan->acc = acc;
+	plan->dec = dec;
+
+	/* the start and end speeds can't be above the velocity we are allowed to run at */
+	plan->v_start = fmin(fmax(v_start, 0), velocity);
+	plan->v_end = fmin(fmax(v_end, 0), velocity);
+
+	double D = plan->distance;
+	double v0_sq = plan->v_start * plan->v_start;
+	double v1_sq = plan->v_end * plan->v_end;
+	double d_acc = ((velocity * velocity) - v0_sq) / (2.0 * acc);
+	double d_dec = ((velocity * velocity) - v1_sq) / (2.0 * dec);
+
+	if(d_acc + d_dec <= D)
+	{
+		plan->triangle = false;
+		plan->v_peak = velocity;
+	}
+	else
+	{
+		plan->triangle = true;
+		plan->v_peak = sqrt(((2.0 * acc * dec * D) + (dec * v0_sq) + (acc * v1_sq)) / (acc + dec));
+
+		/* too short to even get from v_start to v_end - run the whole move at the slower of the two */
+		if(plan->v_peak < fmax(plan->v_start, plan->v_end))
+		{
+			plan->v_peak = fmin(plan->v_start, plan->v_end);
+		}
+
+		d_acc = fmax(0, ((plan->v_peak * plan->v_peak) - v0_sq) / (2.0 * acc));
+		d_dec = fmax(0, ((plan->v_peak * plan->v_peak) - v1_sq) / (2.0 * dec));
+	}
+
+	/**
+	 * round the ramps down to whole steps. the accel has to end before the last step, otherwise the accel phase
+	 * would be mistaken for the decel phase (see trap_acc_dec()). the decel always has the last step at least -
+	 * a move that never leaves v_start (one step, or -v at -s) still needs a phase that ends it
+	 **/
+	plan->acc_stop_point = (int64_t)floor(d_acc);
+	plan->dec_start_point = plan->distance - (int64_t)floor(d_dec);
+
+	if(plan->acc_stop_point >= plan->distance && plan->distance > 0)
+	{
+		plan->acc_stop_point = plan->distance - 1;
+	}
+
+	if(plan->dec_start_point >= plan->distance && plan->distance > 0)
+	{
+		plan->dec_start_point = plan->distance - 1;
+	}
+
+	if(plan->dec_start_point < plan->acc_stop_point)
+	{
+		plan->dec_start_point = plan->acc_stop_point;
+	}
+
+	plan->t_acc = (plan->v_peak - plan->v_start) / acc;
+	plan->t_dec = (plan->v_peak - plan->v_end) / dec;
+	plan->t_run = (plan->v_peak > 0) ? (D - d_acc - d_dec) / plan->v_peak : 0;
+
+	if(plan->t_run < 0)
+	{
+		plan->t_run = 0;
+	}
+
+	plan->t_total = plan->t_acc + plan->t_run + plan->t_dec;
+
+	return 0;
+}
+
+/* the move never cruises inside a resonance band (see resonance.h) */
+int8_t plan_move(const struct move_params *mp, struct move_plan *plan)
+{
+	double cruise = resonance_cruise(mp->velocity, mp->starting_speed, mp->velocity);
+
+	if(cruise < 0)
+	{
+		fprintf(stderr, "\nERROR: %.0fHz is inside a resonance band with no edge between the starting speed and the velocity\n", mp->velocity);
+		return -1;
+	}
+
+	return plan_profile(mp->num_steps, mp->starting_speed, mp->starting_speed, cruise, mp->acc, mp->dec, plan);
+}
+
+/**
+ * Builds a ramp that starts at v_start and accelerates at up to cap, for at most max_steps steps or until it reaches v_max.
+ * Resonance bands are crossed at their own acceleration, if they have one.
+ * (*v)[i] is the speed at step i - the array is allocated here, since a ramp is usually much shorter than the move.
+ * Returns the number of steps taken to reach v_max (max_steps if it never does), -1 if out of memory.
+ **/
+static int64_t _ramp(const double v_start, const double v_max, const double cap, const int64_t max_steps, double **v)
+{
+	int64_t i = 0;
+	int64_t size = 1024;
+
+	if((*v = malloc(size * sizeof(double))) == NULL)
+	{
+		return -1;
+	}
+
+	(*v)[0] = v_start;
+
+	while(i < max_steps && (*v)[i] < v_max)
+	{
+		if(i + 1 == size)
+		{
+			double *grown = realloc(*v, 2 * size * sizeof(double));
+
+			if(grown == NULL)
+			{
+				return -1;
+			}
+
+			*v = grown;
+			size *= 2;
+		}
+
+		double next = sqrt(((*v)[i] * (*v)[i]) + (2.0 * resonance_accel((*v)[i], accel_curve_limit((*v)[i], cap))));
+		(*v)[i + 1] = (next < v_max) ? next : v_max;
+		i++;
+	}
+
+	return i;
+}
+
+static int8_t _fill(struct step_schedule *s, const int64_t first_step, const int64_t count, const double *v, const int8_t reverse, double *t)
+{
+	s->first_step = first_step;
+	s->count = count;
+	s->interval_ns = NULL;
+	s->cached = false;
+	*t = 0;
+
+	if(count == 0)
+	{
+		return 0;
+	}
+
+	if((s->interval_ns = malloc(count * sizeof(uint32_t))) == NULL)
+	{
+		return -1;
+	}
+
+	/* the decel ramp was built backwards from the end of the move, so step i of the schedule is v[count - i] to v[count - i - 1] */
+	for(int64_t i = 0; i < count; i++)
+	{
+		double v_in = (reverse == 0) ? v[i] : v[count - i];
+		double v_out = (reverse == 0) ? v[i + 1] : v[count - i - 1];
+		double dt = 2.0 / (v_in + v_out);
+
+		s->interval_ns[i] = (uint32_t)llround(dt * NSEC_PER_SEC);
+		*t += dt;
+	}
+
+	return 0;
+}
+
+int8_t plan_schedules(const struct move_params *mp, struct move_plan *plan, struct step_schedule *accel, struct step_schedule *decel)
+{
+	accel->interval_ns = NULL;
+	accel->cached = false;
+	decel->interval_ns = NULL;
+	decel->cached = false;
+
+	/* the closed form plan gives the distance, speeds and the run velocity. the ramps are then redone step by step */
+	if(plan_move(mp, plan) != 0)
+	{
+		return -1;
+	}
+
+	const int64_t D = plan->distance;
+	const double v_max = resonance_cruise(mp->velocity, mp->starting_speed, mp->velocity);
+
+	if(D == 0)
+	{
+		accel->count = 0;
+		decel->count = 0;
+		return 0;
+	}
+
+	/* va[i] is the speed at step i going forward, vd[i] the speed i steps before the end going backward */
+	double *va = NULL;
+	double *vd = NULL;
+	int64_t na = _ramp(plan->v_start, v_max, mp->acc, D, &va);
+	int64_t nd = _ramp(plan->v_end, v_max, mp->dec, D, &vd);
+
+	if(na < 0 || nd < 0)
+	{
+		free(va);
+		free(vd);
+		return -1;
+	}
+
+	if(na + nd <= D)
+	{
+		plan->triangle = false;
+		plan->v_peak = v_max;
+		plan->acc_stop_point = na;
+		plan->dec_start_point = D - nd;
+	}
+	else
+	{
+		/* triangle - the first step where the accel ramp catches up with the decel ramp */
+		int64_t p = (D - nd > 0) ? D - nd : 0;
+
+		while(p < na && va[p] < vd[D - p])
+		{
+			p++;
+		}
+
+		plan->triangle = true;
+		plan->v_peak = fmin(va[p], vd[D - p]);
+		plan->acc_stop_point = p;
+		plan->dec_start_point = p;
+
+		/* the ramps only need to reach the peak */
+		va[p] = plan->v_peak;
+		vd[D - p] = plan->v_peak;
+	}
+
+	/* same rules as plan_profile() - the accel phase has to end before the last step, the decel has the last step at least */
+	if(plan->acc_stop_point >= D)
+	{
+		plan->acc_stop_point = D - 1;
+		plan->dec_start_point = (plan->dec_start_point < plan->acc_stop_point) ? plan->acc_stop_point : plan->dec_start_point;
+	}
+
+	/* a decel ramp of no steps starts at v_max already - its one step stays there. _ramp() allocates room for it */
+	if(plan->dec_start_point >= D)
+	{
+		plan->dec_start_point = D - 1;
+	}
+
+	if(nd == 0)
+	{
+		vd[1] = vd[0];
+	}
+
+	int8_t ret = 0;
+
+	if(_fill(accel, 0, plan->acc_stop_point, va, 0, &plan->t_acc) != 0 || _fill(decel, plan->dec_start_point, D - plan->dec_start_point, vd, 1, &plan->t_dec) != 0)
+	{
+		schedule_free(accel);
+		schedule_free(decel);
+		ret = -1;
+	}
+
+	plan->t_run = (plan->v_peak > 0) ? (plan->dec_start_point - plan->acc_stop_point) / plan->v_peak : 0;
+	plan->t_total = plan->t_acc + plan->t_run + plan->t_dec;
+
+	free(va);
+	free(vd);
+
+	return ret;
+}
+
+void schedule_free(struct step_schedule *s)
+{
+	if(s->cached == false)
+	{
+		free(s->interval_ns);
+	}
+
+	s->cached = false;
+	s->interval_ns = NULL;
+	s->count = 0;
+}
+
+/* the time, in seconds from the start of the sweep, at which the chirp has gone through k cycles */
+static long double _sweep_time(const struct sweep_params *sp, const long double T, const long double k)
+{
+	const long double f0 = sp->f_start;
+	const long double f1 = sp->f_end;
+
+	if(f0 == f1)
+	{
+		return k / f0;
+	}
+
+	/* exponential: f(t) = f0 * r^(t/T), so k = f0 * T * (r^(t/T) - 1) / ln(r) */
+	if(sp->log == true)
+	{
+		long double ln_r = logl(f1 / f0);
+		return (T / ln_r) * logl(1.0 + ((k * ln_r) / (f0 * T)));
+	}
+
+	/* linear: f(t) = f0 + (f1 - f0) * t/T, so k = f0 * t + (f1 - f0) * t^2 / 2T. rounding N can take the root a hair below 0 */
+	long double c = (f1 - f0) / (2.0 * T);
+	return (2.0 * k) / (f0 + sqrtl(fmaxl(0, (f0 * f0) + (4.0 * c * k))));
+}
+
+int8_t plan_sweep(const struct sweep_params *sp, struct step_schedule *s)
+{
+	s->first_step = 0;
+	s->count = 0;
+	s->interval_ns = NULL;
+	s->cached = false;
+
+	/* interval_ns holds at most ~4.29s */
+	if(sp->f_start < 1 || sp->f_end < 1 || (sp->duration <= 0 && sp->steps <= 0) || sp->dwell < 0)
+	{
+		return -1;
+	}
+
+	const long double f0 = sp->f_start;
+	const long double f1 = sp->f_end;
+	long double T = sp->duration;
+	int64_t N = sp->steps;
+
+	/* the sweep length is given either as a duration or as a step count - work out the other one */
+	if(T > 0)
+	{
+		long double cycles = (sp->log == true && f0 != f1) ? (f0 * T * ((f1 / f0) - 1.0)) / logl(f1 / f0) : (T * (f0 + f1)) / 2.0;
+		N = llroundl(cycles);
+	}
+	else
+	{
+		T = (sp->log == true && f0 != f1) ? (N * logl(f1 / f0)) / (f0 * ((f1 / f0) - 1.0)) : (2.0 * N) / (f0 + f1);
+	}
+
+	if(N <= 0 || (s->interval_ns = malloc(N * sizeof(uint32_t))) == NULL)
+	{
+		return -1;
+	}
+
+	s->count = N;
+
+	/* step edges are rounded to whole ns on the sweep timeline, not per interval, so the rounding doesn't add up */
+	int64_t t_prev = 0;
+	long double f_hold = f0;
+
+	for(int64_t k = 0; k < N; k++)
+	{
+		if(sp->dwell > 0)
+		{
+			if(k % sp->dwell == 0)
+			{
+				long double t_k = _sweep_time(sp, T, k);
+				f_hold = (sp->log == true) ? f0 * powl(f1 / f0, t_k / T) : f0 + ((f1 - f0) * t_k / T);
+			}
+
+			s->interval_ns[k] = (uint32_t)llroundl(NSEC_PER_SEC / f_hold);
+			continue;
+		}
+
+		int64_t t_next = llroundl(_sweep_time(sp, T, k + 1) * NSEC_PER_SEC);
+		s->interval_ns[k] = (uint32_t)(t_next - t_prev);
+		t_prev = t_next;
+	}
+
+	return 0;
+}
+
+void plan_print(const struct move_plan *plan)
+{
+	printf("\nMOVE STATISTICS - %s Move:\n", (plan->triangle == true) ? "Triangle" : "Trapezoidal");
+	printf("Total number of steps:\t\t\t%" PRId64 "\n", plan->distance);
+	printf("Acceleration stop point (steps):\t%" PRId64 "\n", plan->acc_stop_point);
+	printf("Deceleration start point (steps):\t%" PRId64 "\n", plan->dec_start_point);
+	printf("Peak velocity (steps/s):\t\t%F\n", plan->v_peak);
+	printf("Planned move time (s):\t\t\t%F (acc %F, run %F, dec %F)\n", plan->t_total, plan->t_acc, plan->t_run, plan->t_dec);
+}
@@ -0,0 +1,108 @@
+/*
+*	planner.h
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include <stdint.h>
+
+#include "motion_control.h"
+
+/* bump this whenever a change to the planner changes the plans or schedules it makes - cached plans from other versions are discarded */
+#define PLANNER_VERSION 3
+
+/**
+ * MOVE PLANNER
+ * Solves the minimum time trapezoid (or triangle, if the move is too short to reach velocity) for a move, exactly:
+ * - acceleration and deceleration can differ
+ * - the move starts at v_start and ends at v_end, which do not have to be zero
+ * - the direction of the move does not matter, the plan is always in absolute steps
+ *
+ * With d_acc(v) = (v^2 - v_start^2) / 2a and d_dec(v) = (v^2 - v_end^2) / 2d, the move is a trapezoid if
+ * d_acc(velocity) + d_dec(velocity) fits in the distance. Otherwise the peak velocity is where the two ramps meet:
+ * v_peak^2 = (2adD + d*v_start^2 + a*v_end^2) / (a + d)
+ *
+ * The velocity is first moved out of any resonance band (see resonance.h).
+ **/
+struct move_plan
+{
+	int64_t distance;			/* steps, always positive */
+	double v_start;				/* steps/s */
+	double v_end;				/* steps/s */
+	double v_peak;				/* steps/s, the velocity actually reached */
+	double acc;					/* steps/s^2 */
+	double dec;					/* steps/s^2 */
+
+	int64_t acc_stop_point;		/* absolute step where the acceleration ends */
+	int64_t dec_start_point;	/* absolute step where the deceleration starts */
+
+	double t_acc;				/* seconds */
+	double t_run;
+	double t_dec;
+	double t_total;
+
+	_Bool triangle;				/* 1 if velocity could not be reached */
+};
+
+/**
+ * Plans a move with the given start and end speeds.
+ * Returns 0 on success, -1 if the parameters can't make a move (non-positive acc/dec/velocity).
+ **/
+int8_t plan_profile(const int64_t num_steps, const double v_start, const double v_end, const double velocity, const double acc, const double dec, struct move_plan *plan);
+
+/* plans mp as executed by execute_move() - the move starts and ends at mp->starting_speed */
+int8_t plan_move(const struct move_params *mp, struct move_plan *plan);
+
+/**
+ * STEP INTERVAL SCHEDULES
+ * The accel and decel ramps are planned step by step before the move starts, so the pulse loop only has to look up
+ * the time to the next step. Within one step the acceleration is held constant at its value for the speed at the
+ * start of the step (from the acceleration curve, see accel_curve.h), which makes v^2 grow by 2a per step and the
+ * step take 2 / (v_in + v_out) seconds.
+ **/
+struct step_schedule
+{
+	int64_t first_step;			/* absolute step that interval_ns[0] belongs to */
+	int64_t count;
+	uint32_t *interval_ns;		/* time from the start of this step to the start of the next, in ns */
+	_Bool cached;				/* interval_ns points into the plan cache and is not freed */
+};
+
+/**
+ * Plans mp step by step with the acceleration curve (constant mp->acc/mp->dec without one) and builds the accel and
+ * decel schedules. plan is filled in like plan_move() does. The schedules are allocated here and released with schedule_free().
+ * Returns 0 on success, -1 on failure.
+ **/
+int8_t plan_schedules(const struct move_params *mp, struct move_plan *plan, struct step_schedule *accel, struct step_schedule *decel);
+
+void schedule_free(struct step_schedule *s);
+
+/**
+ * FREQUENCY SWEEPS
+ * A chirp from f_start to f_end for mapping resonances (see -w). The frequency changes linearly or exponentially with
+ * time, and the sweep is planned into a step schedule up front like the ramps above. Without dwell, step k is issued when
+ * the chirp's phase reaches k cycles. With dwell, the frequency is held for dwell steps at a time at the chirp's
+ * frequency where each hold starts - a staircase, which gives the axis time to settle at each frequency.
+ **/
+struct sweep_params
+{
+	double f_start;				/* Hz */
+	double f_end;				/* Hz */
+	_Bool log;					/* 1 for an exponential sweep, same time per octave */
+	double duration;			/* seconds, or 0 to use steps */
+	int64_t steps;				/* length of the sweep in steps if duration is 0 */
+	int64_t dwell;				/* steps to hold each frequency, 0 for a continuous sweep */
+};
+
+/* plans the sweep into a schedule starting at step 0, released with schedule_free(). returns 0 on success, -1 on failure */
+int8_t plan_sweep(const struct sweep_params *sp, struct step_schedule *s);
+
+/* prints the plan in the same format as the rest of the verbose move statistics */
+void plan_print(const struct move_plan *plan);
+
+#endif /*PLANNER_H*/
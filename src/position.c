@@ -0,0 +1,136 @@
+/*
+*	position.c
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#include "position.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+static struct axis_position *state = NULL;
+
+/* the file is tiny - write it through right away so a power cut doesn't lose a move */
+static void _sync(void)
+{
+	msync(state, sizeof(*state), MS_SYNC);
+}
+
+int8_t position_init(const char *path)
+{
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	struct stat st;
+
+	if(fd < 0)
+	{
+		perror("\nERROR: Could not open position file");
+		return -1;
+	}
+
+	/* two runs moving the same axis would each think they know where it is */
+	if(flock(fd, LOCK_EX | LOCK_NB) < 0)
+	{
+		perror("\nERROR: Could not lock position file");
+		close(fd);
+		return -1;
+	}
+
+	if(fstat(fd, &st) < 0 || ((size_t)st.st_size != sizeof(*state) && ftruncate(fd, sizeof(*state)) < 0))
+	{
+		perror("\nERROR: Could not size position file");
+		close(fd);
+		return -1;
+	}
+
+	void *p = mmap(NULL, sizeof(*state), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	/* the lock belongs to the open file, so fd stays open until exit */
+	if(p == MAP_FAILED)
+	{
+		perror("\nERROR: Could not map position file");
+		close(fd);
+		return -1;
+	}
+
+	state = p;
+
+	if(state->magic != POSITION_MAGIC || state->version != POSITION_VERSION)
+	{
+		/* a new file (or one we can't read) - the axis could be anywhere */
+		state->magic = POSITION_MAGIC;
+		state->version = POSITION_VERSION;
+		state->position = 0;
+		state->valid = 0;
+		state->in_motion = 0;
+		state->moves = 0;
+		_sync();
+	}
+	else if(state->in_motion != 0)
+	{
+		fprintf(stderr, "\nWARNING: The last move did not finish, the axis position is unknown until it is set again (-L)\n");
+		state->valid = 0;
+		state->in_motion = 0;
+		_sync();
+	}
+
+	return 0;
+}
+
+_Bool position_active(void)
+{
+	return state != NULL;
+}
+
+_Bool position_valid(void)
+{
+	return state != NULL && state->valid != 0;
+}
+
+int64_t position_get(void)
+{
+	return (state != NULL) ? state->position : 0;
+}
+
+void position_set(const int64_t position)
+{
+	if(state == NULL)
+	{
+		return;
+	}
+
+	state->position = position;
+	state->valid = 1;
+	_sync();
+}
+
+void position_move_begin(void)
+{
+	if(state == NULL)
+	{
+		return;
+	}
+
+	state->in_motion = 1;
+	_sync();
+}
+
+void position_move_end(const int8_t direction, const uint64_t steps)
+{
+	if(state == NULL)
+	{
+		return;
+	}
+
+	state->position += (direction < 0) ? -(int64_t)steps : (int64_t)steps;
+	state->moves++;
+	state->in_motion = 0;
+	_sync();
+}
@@ -0,0 +1,54 @@
+/*
+*	position.h
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#ifndef POSITION_H
+#define POSITION_H
+
+#include <stdint.h>
+
+#define POSITION_MAGIC 0x52484250	/* "RHBP" */
+#define POSITION_VERSION 1
+
+/**
+ * ABSOLUTE POSITION
+ * The axis position is kept in a small memory mapped state file (see -l), so it survives between runs.
+ * Positions are in steps, CW positive.
+ *
+ * The file is only written before and after a move, never from the pulse loop. A move marks the file as in motion when
+ * it starts, and adds the steps it actually issued when it ends - completed, stopped or e-stopped. If a run dies in the
+ * middle of a move the mark stays, and the position is treated as unknown until it is set again (-L or homing).
+ **/
+struct axis_position
+{
+	uint32_t magic;
+	uint32_t version;
+	int64_t position;		/* steps from the origin */
+	uint8_t valid;			/* 0 until the position has been set - the origin is unknown */
+	uint8_t in_motion;		/* 1 while a move runs */
+	uint64_t moves;			/* moves completed since the file was created */
+};
+
+/* opens (or creates) and maps the state file. returns 0 on success, -1 on failure */
+int8_t position_init(const char *path);
+
+/* 1 if position_init() succeeded */
+_Bool position_active(void);
+
+/* 1 if the position is known - it has been set, and no move was cut off part way */
+_Bool position_valid(void);
+
+int64_t position_get(void);
+
+/* sets the current position, e.g. after homing. makes the position valid */
+void position_set(const int64_t position);
+
+/* called around every move. direction is 1 CW, -1 CCW, steps are the steps actually issued */
+void position_move_begin(void);
+void position_move_end(const int8_t direction, const uint64_t steps);
+
+#endif /*POSITION_H*/
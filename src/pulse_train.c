@@ -10,6 +10,23 @@
 #include "motion_control.h"
 #include "globals.h"
 #include "debounce.h"
+#include "encoder.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "feed_override.h"
+#include "stop_request.h"
+#include "planner.h"
+#include "timebase.h"
+#include "homing.h"
+#include "jog.h"
+#include "position.h"
+#include "resonance.h"
+#include "accel_curve.h"
+#include "gearing.h"
+#include "perf_counters.h"
+#include "state_machine.h"
+#include "watchdog.h"
+#include "replay.h"
 
 #include <wiringPi.h>
 #include <time.h>
@@ -17,19 +34,114 @@
 #include <inttypes.h>
 #include <math.h>
 #include <assert.h>
+#include <errno.h>
+#include <string.h>
 
 extern _Bool VERBOSE;
 extern _Bool NO_MOTOR;
 extern int8_t WIRINGPI_PULSE_OUTPUT;
+extern int8_t WIRINGPI_DIRECTION_OUTPUT;
 extern int8_t WIRINGPI_ESTOP_INPUT;
+extern int8_t WIRINGPI_MASTER_A_INPUT;
+extern int8_t WIRINGPI_MASTER_B_INPUT;
+extern int8_t OVERRUN_POLICY;
+extern int32_t CATCHUP_MAX_FREQ;
+extern int32_t STOP_DECEL;
 
-static struct timespec t;
+/* the pulse loop state is per thread, so moves can be run side by side on virtual clocks (see timebase.h) */
+static __thread struct timespec t;
 
-static int8_t _pulse(const long double freq, uint64_t *motor_pos, long double *a_rate, int64_t *stop_point);
+/* the sub-nanosecond part of t, so that rounding to whole nanoseconds doesn't add up over a move */
+static __thread long double t_frac = 0;
+static __thread struct overrun_stats overruns;
+
+/* the frequency the last _pulse() call ended at, so the next phase of a move picks up where the last one left off */
+static __thread long double last_freq = 0;
+
+/* the fastest the current move has pulsed */
+static __thread long double peak_freq = 0;
+
+/* why the current move is decelerating to a stop - PULSE_ERR_STOPPED for a signal, PULSE_ERR_OVERRUN for -p abort, PULSE_ERR_HOMED for the home switch. 0 if it isn't */
+static __thread int8_t stop_reason = 0;
+
+/* the direction of the jog segment being run (1 CW, -1 CCW), 0 when not jogging */
+static __thread int8_t jog_direction = 0;
+
+/* the trace being replayed, NULL when not replaying */
+static __thread struct replay *replaying = NULL;
+
+/* without a move's starting speed to stop at (pulse train mode), stop once we are down to this */
+#define STOP_FREQ_DEFAULT 100
+
+/* how long the direction output has to be stable before a step, and how often a held jog looks at the command */
+#define DIRECTION_SETUP_NS 50000
+#define JOG_POLL_NS 10000000
+
+/* how often a following axis with nothing to do looks at the master, and the window its speed is measured over */
+#define FOLLOW_POLL_NS 100000
+#define FOLLOW_VELOCITY_WINDOW_NS 10000000
+
+static int8_t _pulse(const long double freq, uint64_t *motor_pos, long double *a_rate, int64_t *stop_point, const struct move_params *mp, const struct step_schedule *schedule);
+static int8_t _pulse_loop(const long double freq, uint64_t *motor_pos, long double *a_rate, int64_t *stop_point, const struct move_params *mp, const struct step_schedule *schedule);
+
+/* on a virtual clock there is no hardware to drive */
+static inline void _write_output(const int level)
+{
+	if(timebase_virtual() == false)
+	{
+		digitalWrite(WIRINGPI_PULSE_OUTPUT, level);
+	}
+}
+
+/* v scaled by the feed override. up to 150% could be past what the pulse output can do, so it stops at MAX_FREQ */
+static inline long double _overridden(const long double v)
+{
+	return fminl(v * feed_override(), MAX_FREQ);
+}
+
+/* v out of any resonance band, between the starting speed and the faster of the move's velocity and v. inside a band with no way out it stays */
+static inline long double _cruise(const struct move_params *mp, const long double v)
+{
+	long double cruise = resonance_cruise(v, mp->starting_speed, fmaxl(mp->velocity, v));
+
+	return (cruise > 0) ? cruise : v;
+}
+
+/* sets the direction output to the trace being replayed, if a direction record was read since the last call */
+static inline void _replay_direction(struct replay *r)
+{
+	if(r->direction_changed == false)
+	{
+		return;
+	}
+
+	if(timebase_virtual() == false)
+	{
+		digitalWrite(WIRINGPI_DIRECTION_OUTPUT, r->direction);
+	}
+
+	trace_direction(r->direction);
+	r->direction_changed = false;
+}
+
+/* moves t on by ns, carrying the fraction of a nanosecond */
+static inline void _advance(const long double ns)
+{
+	long double next = t.tv_nsec + ns + t_frac;
+
+	t.tv_nsec = (long)next;
+	t_frac = next - t.tv_nsec;
+	tsnorm(&t);
+}
+
+static inline int64_t _ts_diff_ns(const struct timespec *a, const struct timespec *b)
+{
+	return ((int64_t)(a->tv_sec - b->tv_sec) * NSEC_PER_SEC) + (a->tv_nsec - b->tv_nsec);
+}
 
 /**
  * PULSE TRAIN OPERATION
- * This will send out a pulse of a certain frequency until the user exits with ctrl-c or stop_point is reached.
+ * This will send out a pulse of a certain frequency until the user stops it with ctrl-c or stop_point is reached.
  * freq: pulse frequency in Hz.
  * stop_point: stopping point in steps. If zero, program assumes infinite move.
  * *motor_pos: current motor position (updated to the caller)
@@ -42,13 +154,64 @@ int8_t pulse_train(const int32_t freq, const int64_t *stop_point, uint64_t *moto
 	{
 		int64_t abs_stop = abs(*stop_point);
 
-		fprintf(stderr, "\nPulsing at %dHz on WiringPi output %d for %" PRId64 " steps...\nPress Ctrl-C to exit...\n", freq, WIRINGPI_PULSE_OUTPUT, *stop_point);
-		return _pulse(freq, motor_pos, NULL, &abs_stop);
+		fprintf(stderr, "\nPulsing at %dHz on WiringPi output %d for %" PRId64 " steps...\nPress Ctrl-C to stop...\n", freq, WIRINGPI_PULSE_OUTPUT, *stop_point);
+		return _pulse(freq, motor_pos, NULL, &abs_stop, NULL, NULL);
 	}
 
 	/* if stop point is NULL, then we are outputting an infinite pulse train */
-	fprintf(stderr, "\nPulsing at %dHz on WiringPi output %d...\nPress Ctrl-C to exit...\n", freq, WIRINGPI_PULSE_OUTPUT);
-	return _pulse(freq, motor_pos, NULL, NULL);
+	fprintf(stderr, "\nPulsing at %dHz on WiringPi output %d...\nPress Ctrl-C to stop...\n", freq, WIRINGPI_PULSE_OUTPUT);
+	return _pulse(freq, motor_pos, NULL, NULL, NULL, NULL);
+}
+
+/**
+ * SWEEP OPERATION
+ * Pulses out a planned frequency sweep (see plan_sweep()) until it ends or the user stops it with ctrl-c.
+ * The sweep is just a schedule for the whole move, so the loop only looks up the next interval.
+ **/
+int8_t pulse_sweep(const struct sweep_params *sp, const struct step_schedule *sweep, uint64_t *motor_pos)
+{
+	int64_t stop_point = sweep->count;
+
+	fprintf(stderr, "\nSweeping %.0fHz to %.0fHz (%s%s) on WiringPi output %d for %" PRId64 " steps...\nPress Ctrl-C to stop...\n", sp->f_start, sp->f_end, (sp->log == true) ? "logarithmic" : "linear", (sp->dwell > 0) ? ", stepped" : "", WIRINGPI_PULSE_OUTPUT, stop_point);
+	return _pulse(NSEC_PER_SEC / (long double)sweep->interval_ns[0], motor_pos, NULL, &stop_point, NULL, sweep);
+}
+
+/**
+ * REPLAY OPERATION
+ * Pulses out the edges of a recorded trace (see replay.h) until they run out or the user stops it with ctrl-c.
+ * The loop takes the time to each next edge from the trace instead of a frequency, so the high and low halves of
+ * every step are as recorded too, and so are the direction changes. A stop decelerates from the recorded speed, like a pulse train.
+ **/
+int8_t pulse_replay(struct replay *r, uint64_t *motor_pos, const int8_t direction)
+{
+	struct timespec now;
+	int64_t stop_point = r->steps;
+	int64_t first = replay_next_interval(r);
+
+	/* the first interval sets the starting speed, the loop then reads the rest as it goes */
+	replay_rewind(r);
+
+	/* steps before the first direction record go the way the caller says */
+	if(r->direction < 0)
+	{
+		r->direction = (direction > 0) ? 1 : 0;
+		r->direction_changed = true;
+	}
+
+	/* the drive latches the direction on the step edge - give it the setup time before the first step */
+	_replay_direction(r);
+	timebase_now(&now);
+	now.tv_nsec += DIRECTION_SETUP_NS;
+	tsnorm(&now);
+	timebase_sleep_until(&now);
+
+	fprintf(stderr, "\nReplaying %" PRId64 " steps over %.6fs on WiringPi output %d...\nPress Ctrl-C to stop...\n", stop_point, r->duration_ns / 1e9, WIRINGPI_PULSE_OUTPUT);
+
+	replaying = r;
+	int8_t ret = _pulse((first > 0) ? NSEC_PER_SEC / (2.0L * first) : MAX_FREQ, motor_pos, NULL, &stop_point, NULL, NULL);
+	replaying = NULL;
+
+	return ret;
 }
 
 /** 
@@ -59,8 +222,9 @@ int8_t pulse_train(const int32_t freq, const int64_t *stop_point, uint64_t *moto
  * motor_pos: current motor position (updated to the caller)
  * times: array of the time in nanoseconds for each step that is size num_steps
  * positions: array of the positions for each step that is size num_steps
+ * schedule: the planned step intervals for this ramp (see planner.h). NULL integrates the ramp at mp.acc/mp.dec while pulsing
  **/
-int8_t trap_acc_dec(const struct move_params mp, const int64_t stop_point, uint64_t *motor_pos, double *times, uint64_t *positions)
+int8_t trap_acc_dec(const struct move_params mp, const int64_t stop_point, uint64_t *motor_pos, double *times, uint64_t *positions, const struct step_schedule *schedule)
 {
 	/**
 	 * There are several different scenarios to consider in this block:
@@ -83,11 +247,40 @@ int8_t trap_acc_dec(const struct move_params mp, const int64_t stop_point, uint6
 	if(acc_stop_point == mp.num_steps)
 	{
 		int8_t retval = 0;
-		long double dec = mp.dec * -1;
 
-		printf("\nusing v: %F\n", mp.velocity);
+		/**
+		 * the run phase may have ended slower than planned (feed override below 100%). In that case, spread the decel
+		 * over the remaining distance instead of stopping short - never decelerate harder than mp.dec though, or than
+		 * the -T curve allows anywhere on the way down.
+		 **/
+		long double entry_freq = (last_freq > 0) ? last_freq : mp.velocity;
+		long double remaining = acc_stop_point - (int64_t)*motor_pos;
+		long double dec = mp.dec;
+
+		/* nothing left to decelerate over - starting the loop now would step past the end */
+		if(remaining <= 0)
+		{
+			return 0;
+		}
+
+		long double spread = ((entry_freq * entry_freq) - ((long double)mp.starting_speed * mp.starting_speed)) / (2.0 * remaining);
+
+		if(remaining > 0 && spread > 0 && spread < dec && spread <= accel_curve_min(mp.starting_speed, entry_freq, dec))
+		{
+			dec = spread;
+		}
+
+		dec = dec * -1;
 
-		retval = _pulse(mp.velocity, motor_pos, &dec, &acc_stop_point);
+		/* the planned decel only fits if we arrive at the planned velocity, where it was planned to start */
+		if(schedule != NULL && (*motor_pos != schedule->first_step || fabsl(entry_freq - mp.velocity) > (mp.velocity * 0.01)))
+		{
+			schedule = NULL;
+		}
+
+		printf("\nusing v: %LF\n", entry_freq);
+
+		retval = _pulse(entry_freq, motor_pos, &dec, &acc_stop_point, &mp, schedule);
 
 		if( retval < 0)
 		{
@@ -101,8 +294,9 @@ int8_t trap_acc_dec(const struct move_params mp, const int64_t stop_point, uint6
 		if(*motor_pos == 0)
 		{	
 			int8_t retval = 0;
+			last_freq = 0;
 			long double acc = mp.acc;
-			retval = _pulse(mp.starting_speed, motor_pos, &acc, &acc_stop_point);
+			retval = _pulse(mp.starting_speed, motor_pos, &acc, &acc_stop_point, &mp, schedule);
 
 			if( retval < 0)
 			{
@@ -115,13 +309,422 @@ int8_t trap_acc_dec(const struct move_params mp, const int64_t stop_point, uint6
 	return 0;
 }
 
+/**
+ * RUN OPERATION
+ * Runs the constant velocity part of a Trapezoidal move, from wherever the acceleration left off up to stop_point.
+ * The velocity follows the feed override, changing at mp.acc/mp.dec. If the override pushes the velocity above the plan,
+ * the run ends early - as soon as the remaining distance is what it takes to stop at mp.dec under the -T curve - so the decel still fits.
+ * stop_point: absolute position (in steps) where the planned deceleration starts
+ * motor_pos: current motor position (updated to the caller)
+ **/
+int8_t trap_run(const struct move_params mp, const int64_t stop_point, uint64_t *motor_pos)
+{
+	int64_t run_stop = stop_point;
+
+	if(run_stop <= (int64_t)*motor_pos)
+	{
+		return 0;
+	}
+
+	return _pulse((last_freq > 0) ? last_freq : mp.velocity, motor_pos, NULL, &run_stop, &mp, NULL);
+}
+
+/**
+ * JOG OPERATION
+ * Runs the axis at the velocity commanded on stdin (see jog.h) until q, the end of the input or a stop request.
+ * Each run in one direction is a segment: it starts at mp.starting_speed, follows the command at mp.acc/mp.dec
+ * and ramps back down to mp.starting_speed before a hold or a reversal. The direction output is only switched
+ * while no pulses are going out, and the first step of the new direction waits DIRECTION_SETUP_NS after it.
+ *
+ * The jog is a profile of the state machine engine (see state_machine.h): hold polls the command, direction
+ * switches the output if the command reversed, and segment runs the pulse loop until the command changes.
+ **/
+enum jog_states {jog_hold, jog_set_direction, jog_segment, jog_exit_success, jog_exit_fail};
+
+/* a jog has no end point - the segment only ends on a command */
+static struct move_params jog_mp;
+static int8_t jog_dir;
+static int8_t jog_ret;
+static int64_t jog_travel;
+
+static int _jog_hold(void);
+static int _jog_direction(void);
+static int _jog_segment(void);
+static int _jog_exit(void);
+
+static const struct sm_state jog_states[] =
+{
+	[jog_hold] = {"hold", _jog_hold, false, false},
+	[jog_set_direction] = {"direction", _jog_direction, false, false},
+	[jog_segment] = {"segment", _jog_segment, false, false},
+	[jog_exit_success] = {"exit with success", _jog_exit, true, false},
+	[jog_exit_fail] = {"exit with fail", _jog_exit, true, true}
+};
+
+/* stop is a quit or a stop request, the normal way to end a jog */
+static const struct sm_transition jog_transitions[] =
+{
+	{jog_hold, sm_done, jog_set_direction},
+	{jog_hold, sm_fail, jog_exit_fail},
+	{jog_hold, sm_repeat, jog_hold},
+	{jog_hold, sm_stop, jog_exit_success},
+
+	{jog_set_direction, sm_done, jog_segment},
+	{jog_set_direction, sm_fail, jog_exit_fail},
+	{jog_set_direction, sm_repeat, jog_set_direction},
+	{jog_set_direction, sm_stop, jog_exit_success},
+
+	{jog_segment, sm_done, jog_hold},
+	{jog_segment, sm_fail, jog_exit_fail},
+	{jog_segment, sm_repeat, jog_segment},
+	{jog_segment, sm_stop, jog_exit_success}
+};
+
+static struct sm_profile jog_profile = {"jog", jog_states, sizeof(jog_states) / sizeof(jog_states[0]), jog_hold, false};
+
+int8_t jog(const struct move_params mp)
+{
+	if(jog_profile.registered == false && sm_register(&jog_profile, jog_transitions, sizeof(jog_transitions) / sizeof(jog_transitions[0])) != 0)
+	{
+		return -1;
+	}
+
+	jog_mp = mp;
+	jog_mp.num_steps = INT64_MAX;
+	jog_dir = 0;
+	jog_ret = 0;
+	jog_travel = 0;
+
+	fprintf(stderr, "\nJogging on WiringPi output %d at up to %.0fHz...\nEnter a velocity in steps/s (negative for CCW, 0 to hold) or q to quit\n", WIRINGPI_PULSE_OUTPUT, mp.velocity);
+
+	pulse_reset_overruns();
+	sm_run(&jog_profile);
+
+	fprintf(stderr, "\nJog ended %" PRId64 " steps from where it started\n", jog_travel);
+	pulse_print_overruns();
+
+	return (jog_ret == PULSE_ERR_STOPPED) ? 0 : jog_ret;
+}
+
+/* holding - poll the command */
+static int _jog_hold(void)
+{
+	struct timespec now;
+
+	if(jog_quit_requested() == true || stop_requested() == true)
+	{
+		return sm_stop;
+	}
+
+	if(jog_command() != 0)
+	{
+		return sm_done;
+	}
+
+	timebase_now(&now);
+	now.tv_nsec += JOG_POLL_NS;
+	tsnorm(&now);
+	timebase_sleep_until(&now);
+
+	return sm_repeat;
+}
+
+/* the drive latches the direction on the step edge - give it the setup time before the first step */
+static int _jog_direction(void)
+{
+	struct timespec now;
+	int8_t next = (jog_command() > 0) ? 1 : -1;
+
+	if(next != jog_dir)
+	{
+		if(timebase_virtual() == false)
+		{
+			digitalWrite(WIRINGPI_DIRECTION_OUTPUT, (next > 0) ? 1 : 0);
+		}
+
+		trace_direction((next > 0) ? 1 : 0);
+
+		timebase_now(&now);
+		now.tv_nsec += DIRECTION_SETUP_NS;
+		tsnorm(&now);
+		timebase_sleep_until(&now);
+		jog_dir = next;
+	}
+
+	return sm_done;
+}
+
+static int _jog_segment(void)
+{
+	uint64_t motor_pos = 0;
+	int64_t stop_point = INT64_MAX;
+
+	telemetry_publish_move(jog_dir);
+	position_move_begin();
+
+	jog_direction = jog_dir;
+	last_freq = 0;
+	jog_ret = _pulse(jog_mp.starting_speed, &motor_pos, NULL, &stop_point, &jog_mp, NULL);
+	jog_direction = 0;
+
+	position_move_end(jog_dir, motor_pos);
+	jog_travel += jog_dir * (int64_t)motor_pos;
+
+	if(jog_ret == PULSE_ERR_STOPPED)
+	{
+		return sm_stop;
+	}
+
+	return (jog_ret == 0) ? sm_done : sm_fail;
+}
+
+static int _jog_exit(void)
+{
+	return sm_done;
+}
+
+/**
+ * FOLLOW OPERATION
+ * Slaves the axis to the master (see gearing.h) until a stop request. Every step, the target position for the current
+ * master position is compared to where the axis is, and the velocity is steered towards the master's speed plus the
+ * fastest speed that can still stop at the target (v^2 = 2 * dec * error) - the axis keeps pace with a steady master
+ * without lagging behind it, and closes any error without overshooting. The velocity changes at mp.acc/mp.dec and never
+ * exceeds mp.velocity. Below mp.starting_speed the axis steps at the starting speed, which is also where it reverses.
+ **/
+int8_t follow(const struct move_params mp)
+{
+	const long double v_max = mp.velocity;
+	const long double v_min = mp.starting_speed;
+	const long double stop_dec = (STOP_DECEL > 0) ? STOP_DECEL : mp.dec;
+
+	int16_t estop_int = 0;
+	int64_t pos = 0;
+	uint64_t steps = 0;
+	int8_t direction = 0;
+	int8_t ret = 0;
+
+	/* signed velocities in steps/s, and the time the last one was held for in ns */
+	long double v = 0;
+	long double v_master = 0;
+	long double dt = FOLLOW_POLL_NS;
+
+	struct timespec now;
+	struct timespec sample_t;
+	int64_t sample_target = 0;
+	int64_t late_ns = 0;
+
+	pulse_reset_overruns();
+	position_move_begin();
+	telemetry_publish_move(1);
+	gearing_start();
+	watchdog_arm();
+
+	timebase_now(&t);
+	t_frac = 0;
+	sample_t = t;
+
+	fprintf(stderr, "\nFollowing the master on WiringPi inputs %d,%d at up to %.0fHz...\nPress Ctrl-C to stop...\n", WIRINGPI_MASTER_A_INPUT, WIRINGPI_MASTER_B_INPUT, mp.velocity);
+
+	while(1)
+	{
+		if((timebase_virtual() == false) ? (debounce_input_read(WIRINGPI_ESTOP_INPUT, &estop_int, t) == 1) : timebase_virtual_estop())
+		{
+			fprintf(stdout, "\n!!!ERROR: E-Stop detected!\n");
+			telemetry_publish_estop();
+			ret = PULSE_ERR_ESTOP;
+			break;
+		}
+
+		if(watchdog_tripped() == true)
+		{
+			fprintf(stdout, "\n!!!ERROR: Pulse loop watchdog tripped!\n");
+			telemetry_publish_estop();
+			ret = PULSE_ERR_WATCHDOG;
+			break;
+		}
+
+		int64_t target = gearing_target();
+		int64_t error = target - pos;
+		int64_t since = _ts_diff_ns(&t, &sample_t);
+		long double desired;
+		long double rate;
+
+		/* the master's speed, in slave steps/s */
+		if(since >= FOLLOW_VELOCITY_WINDOW_NS)
+		{
+			v_master = (long double)(target - sample_target) * NSEC_PER_SEC / since;
+			sample_target = target;
+			sample_t = t;
+		}
+
+		/* a stop request lets go of the master and decelerates at stop_dec */
+		if(stop_requested() == true)
+		{
+			if(fabsl(v) <= v_min || stop_requested_now() == true)
+			{
+				break;
+			}
+
+			desired = 0;
+			rate = stop_dec;
+		}
+		else
+		{
+			desired = v_master + copysignl(sqrtl(2.0 * mp.dec * llabs(error)), error);
+			desired = fmaxl(-v_max, fminl(v_max, desired));
+			rate = (fabsl(desired) > fabsl(v) && desired * v >= 0) ? mp.acc : mp.dec;
+		}
+
+		/* the -T curve limits the rate at the speed we are at */
+		rate = accel_curve_limit(fabsl(v), rate);
+
+		if(desired > v)
+		{
+			v = fminl(desired, v + (rate * dt / NSEC_PER_SEC));
+		}
+		else
+		{
+			v = fmaxl(desired, v - (rate * dt / NSEC_PER_SEC));
+		}
+
+		/* too slow to step at - start (or reverse) at the starting speed if there is an error to close, else wait */
+		if(fabsl(v) < v_min)
+		{
+			if(error == 0 || stop_requested() == true)
+			{
+				v = 0;
+				dt = FOLLOW_POLL_NS;
+				_advance(dt);
+				timebase_sleep_until(&t);
+				continue;
+			}
+
+			v = (error > 0) ? v_min : -v_min;
+		}
+
+		int8_t step_dir = (v > 0) ? 1 : -1;
+
+		/* the drive latches the direction on the step edge - give it the setup time before the next step */
+		if(step_dir != direction)
+		{
+			if(timebase_virtual() == false)
+			{
+				digitalWrite(WIRINGPI_DIRECTION_OUTPUT, (step_dir > 0) ? 1 : 0);
+			}
+
+			trace_direction((step_dir > 0) ? 1 : 0);
+
+			_advance(DIRECTION_SETUP_NS);
+			timebase_sleep_until(&t);
+			direction = step_dir;
+		}
+
+		long double pulse_width = ((1.0/fabsl(v))/2.0)*NSEC_PER_SEC;
+
+		if(NO_MOTOR == false)
+		{
+			_write_output(HIGH);
+		}
+		trace_edge(HIGH, &t, late_ns);
+		_advance(pulse_width);
+		timebase_sleep_until(&t);
+
+		if(NO_MOTOR == false)
+		{
+			_write_output(LOW);
+		}
+		trace_edge(LOW, &t, late_ns);
+		_advance(pulse_width);
+		timebase_sleep_until(&t);
+
+		pos += step_dir;
+		steps++;
+		dt = 2 * pulse_width;
+
+		if(fabsl(v) > peak_freq)
+		{
+			peak_freq = fabsl(v);
+		}
+
+		/* there is no timeline to catch up with - the position loop takes care of a late step, so just carry on from now */
+		timebase_now(&now);
+		late_ns = _ts_diff_ns(&now, &t);
+
+		if(late_ns > (pulse_width / 2))
+		{
+			overruns.detected++;
+			overruns.reanchored++;
+			t = now;
+			t_frac = 0;
+		}
+
+		telemetry_publish_edge(steps, fabsl(v), late_ns);
+	}
+
+	_write_output(LOW);
+	watchdog_disarm();
+	position_move_end((pos < 0) ? -1 : 1, (uint64_t)llabs(pos));
+
+	fprintf(stdout, "\nFollowing ended at %" PRId64 " steps (master at %" PRId64 ", target %" PRId64 ")\n", pos, gearing_master_position(), gearing_target());
+	pulse_print_overruns();
+
+	return ret;
+}
+
+void pulse_reset_overruns(void)
+{
+	memset(&overruns, 0, sizeof(overruns));
+	stop_reason = 0;
+	peak_freq = 0;
+}
+
+struct overrun_stats pulse_overruns(void)
+{
+	return overruns;
+}
+
+long double pulse_peak_freq(void)
+{
+	return peak_freq;
+}
+
+void pulse_print_overruns(void)
+{
+	if(overruns.detected > 0 || VERBOSE == true)
+	{
+		fprintf(stderr, "\nDeadline overruns:\t%" PRIu64 " (catch-up edges: %" PRIu64 ", re-anchored: %" PRIu64 ", aborted: %" PRIu64 ")\n", overruns.detected, overruns.caught_up, overruns.reanchored, overruns.aborted);
+	}
+}
+
+/* every call into the pulse loop is a span in the trace (see trace.h) */
+static int8_t _pulse(const long double freq, uint64_t *motor_pos, long double *a_rate, int64_t *stop_point, const struct move_params *mp, const struct step_schedule *schedule)
+{
+	trace_span_begin(trace_span_pulse);
+	watchdog_arm();
+	int8_t ret = _pulse_loop(freq, motor_pos, a_rate, stop_point, mp, schedule);
+
+	/* a trip on the way out, after the loop last looked, still fails the move */
+	if(watchdog_disarm() == true && ret == 0)
+	{
+		_write_output(LOW);
+		ret = PULSE_ERR_WATCHDOG;
+	}
+
+	trace_span_end(trace_span_pulse);
+
+	return ret;
+}
+
 /**
  * The main pulse driving function. 
  * freq: frequency in Hertz (really, steps/ second)
  * stop_point: the position in steps to stop. If 0, move continues infinitely.
  * *motor_pos: the current position of the motor, in steps
+ * a_rate: acceleration (positive) or deceleration (negative) in steps/s/s to integrate while pulsing. NULL for constant frequency
+ * mp: the move being run, for the feed override and planned stops. NULL for a plain pulse train
+ * schedule: planned step intervals to use instead of integrating a_rate. NULL if there are none
  **/ 
-static int8_t _pulse(const long double freq, uint64_t *motor_pos, long double *a_rate, int64_t *stop_point)
+static int8_t _pulse_loop(const long double freq, uint64_t *motor_pos, long double *a_rate, int64_t *stop_point, const struct move_params *mp, const struct step_schedule *schedule)
 {
 
 	if(stop_point != NULL && *stop_point > 0)
@@ -129,12 +732,23 @@ static int8_t _pulse(const long double freq, uint64_t *motor_pos, long double *a
 		/**
 	 	* Get the time, and load it into t. When clock_nanosleep is called, the TIMER_ABSTIME flag waits until the interval specified in t (the next arg). 
 	 	* normally, if this were a failure, we would return as such, but since this is kind of important, we bail from the program.
+		*
+		* A later phase of the same move carries on from the timeline of the one before - t is already the deadline of
+		* its first step, so wait for it instead of pulsing right away.
 	 	**/
-		if(clock_gettime(CLOCK_MONOTONIC, &t) < 0)
+		if(*motor_pos > 0)
+		{
+			timebase_sleep_until(&t);
+		}
+		else if(timebase_now(&t) < 0)
 		{
 			perror("\n!!!ERROR: ");
 			exit(EXIT_FAILURE);
 		}
+		else
+		{
+			t_frac = 0;
+		}
 
 		/**
 		 * estop_int is the integrator value used to debounce the e-stop switch
@@ -157,6 +771,17 @@ static int8_t _pulse(const long double freq, uint64_t *motor_pos, long double *a
 		long double cur_freq = freq;
 		long double start_time = 0;
 		long double stop_time = 0;
+		int64_t late_ns = 0;
+
+		/* now is when we last woke up, deadline is when we asked to wake up */
+		struct timespec now = t;
+		struct timespec deadline = t;
+		_Bool behind = false;
+		const long double catchup_width = ((1.0/CATCHUP_MAX_FREQ)/2.0)*NSEC_PER_SEC;
+
+		/* deceleration and final speed used if we are asked to stop. a stop decel of 0 means stop on the spot */
+		const long double stop_dec = (STOP_DECEL > 0) ? STOP_DECEL : ((mp != NULL) ? mp->dec : 0);
+		const long double stop_freq = (mp != NULL) ? mp->starting_speed : fminl(freq, STOP_FREQ_DEFAULT);
 		
 		if(VERBOSE == true && a_rate == NULL)
 		{
@@ -168,69 +793,298 @@ static int8_t _pulse(const long double freq, uint64_t *motor_pos, long double *a
 
 		while(1)
 		{	
+			perf_edge_begin();
+
 			if(start_time == 0)
 			{
 				start_time = t.tv_nsec;
 			}
 
 			/* check for e-stop condition */ 
-			if(debounce_input_read(WIRINGPI_ESTOP_INPUT, &estop_int, t) == 1)
+			if((timebase_virtual() == false) ? (debounce_input_read(WIRINGPI_ESTOP_INPUT, &estop_int, t) == 1) : timebase_virtual_estop())
 			{
 				fprintf(stdout, "\n!!!ERROR: E-Stop detected!\n");
+				telemetry_publish_estop();
+				perf_edge_end();
 				return -2;
 			}
 
+			/* the encoder monitor latches this flag from its own thread, so the check here is just a load */
+			if(encoder_fault() == true)
+			{
+				_write_output(LOW);
+				fprintf(stdout, "\n!!!ERROR: Following error limit exceeded (%" PRId64 " steps)!\n", encoder_following_error());
+				telemetry_publish_estop();
+				perf_edge_end();
+				return PULSE_ERR_FOLLOWING;
+			}
+
+			/* the watchdog already forced the output low - don't raise it again */
+			if(watchdog_tripped() == true)
+			{
+				_write_output(LOW);
+				fprintf(stdout, "\n!!!ERROR: Pulse loop watchdog tripped at motor position %" PRIu64 "!\n", *motor_pos);
+				telemetry_publish_estop();
+				perf_edge_end();
+				return PULSE_ERR_WATCHDOG;
+			}
+
+			/* a stop request turns whatever we are doing into a deceleration. once slow enough, stop between pulses */
+			if(stop_reason == 0 && stop_requested() == true)
+			{
+				stop_reason = PULSE_ERR_STOPPED;
+			}
+
+			/* so does the home switch while homing */
+			if(stop_reason == 0 && homing_triggered() == true)
+			{
+				stop_reason = PULSE_ERR_HOMED;
+			}
+
+			if(stop_reason != 0 && should_pulse == 1 && (cur_freq <= stop_freq || stop_dec <= 0 || stop_requested_now() == true))
+			{
+				_write_output(LOW);
+				last_freq = cur_freq;
+				fprintf(stdout, "\nStopped at motor position %" PRIu64 " (from %LFHz)\n", *motor_pos, cur_freq);
+				perf_edge_end();
+
+				/* in pulse train mode, Ctrl-C is the normal way to end */
+				if(mp == NULL && stop_reason == PULSE_ERR_STOPPED)
+				{
+					return 0;
+				}
+
+				return stop_reason;
+			}
+
 			if(should_pulse == 1)
 			{	
 				if(NO_MOTOR == false)
 				{
-					digitalWrite(WIRINGPI_PULSE_OUTPUT, HIGH);
+					_write_output(HIGH);
 				}
 				should_pulse = 0;
 				(*motor_pos)++;
+				trace_edge(HIGH, &deadline, late_ns);
+
+				if(replaying != NULL)
+				{
+					replaying->position += (replaying->direction != 0) ? 1 : -1;
+				}
+
+				/* a planned ramp sets the interval for the whole step, split evenly between the high and low half */
+				if(schedule != NULL && stop_reason == 0)
+				{
+					int64_t k = (int64_t)*motor_pos - 1 - schedule->first_step;
+
+					if(k >= 0 && k < schedule->count)
+					{
+						pulse_width = schedule->interval_ns[k] / 2.0;
+						cur_freq = (long double)NSEC_PER_SEC / schedule->interval_ns[k];
+					}
+				}
 			}
 			else
 			{
 				if(NO_MOTOR == false)
 				{
-					digitalWrite(WIRINGPI_PULSE_OUTPUT, LOW);
+					_write_output(LOW);
 				}
 				should_pulse = 1;
+				trace_edge(LOW, &deadline, late_ns);
 			}
 
+			/* stopping overrides the plan - decelerate at stop_dec until stop_freq */
+			if(stop_reason != 0)
+			{
+				cur_freq = fmaxl(stop_freq, cur_freq - ((accel_curve_limit(cur_freq, stop_dec)/NSEC_PER_SEC)*pulse_width));
+				pulse_width = ((1.0/cur_freq)/2.0)*NSEC_PER_SEC;
+			}
+			/* replaying - the next edge is as far off as it was in the trace */
+			else if(replaying != NULL)
+			{
+				int64_t interval = replay_next_interval(replaying);
+
+				/* a reversal comes up after the low edge, so the output is set in the low half before the next step */
+				_replay_direction(replaying);
+
+				if(interval >= 0)
+				{
+					pulse_width = interval;
+					cur_freq = (interval > 0) ? NSEC_PER_SEC / (2.0L * interval) : MAX_FREQ;
+				}
+			}
+			/* planned ramp - the interval was set on the high edge. drop to integrating only if the feed override wants us slower than the plan */
+			else if(schedule != NULL)
+			{
+				if(mp != NULL && a_rate != NULL && *a_rate > 0 && cur_freq > _overridden(mp->velocity))
+				{
+					schedule = NULL;
+				}
+			}
 			/* if given an acceleration term, use it here */
-			if(a_rate != NULL)
+			else if(a_rate != NULL)
 			{
 				/* accelerating */
 				if(*a_rate > 0)
 				{
-					cur_freq = cur_freq + ((*a_rate/NSEC_PER_SEC)*pulse_width);
+					long double step_acc = resonance_accel(cur_freq, accel_curve_limit(cur_freq, *a_rate));
+					cur_freq = cur_freq + ((step_acc/NSEC_PER_SEC)*pulse_width);
+
+					/* don't accelerate past the overridden velocity. if the override dropped below us, slow down at mp->dec */
+					if(mp != NULL)
+					{
+						long double target = _overridden(mp->velocity);
+
+						if(cur_freq > target)
+						{
+							cur_freq = fmaxl(target, cur_freq - ((step_acc + accel_curve_limit(cur_freq, mp->dec))/NSEC_PER_SEC)*pulse_width);
+						}
+					}
+
 					pulse_width = ((1.0/cur_freq)/2.0)*NSEC_PER_SEC;
 				}
 				else
 				{	
-					long double pos_rate = fabsl(*a_rate);
+					long double pos_rate = resonance_accel(cur_freq, accel_curve_limit(cur_freq, fabsl(*a_rate)));
 					cur_freq = cur_freq - ((pos_rate/NSEC_PER_SEC)*pulse_width);
+
+					/* a decel spread over the remaining distance ends near zero - never let the integration run through it */
+					if(mp != NULL && cur_freq < mp->starting_speed)
+					{
+						cur_freq = mp->starting_speed;
+					}
+
 					pulse_width = ((1.0/cur_freq)/2.0)*NSEC_PER_SEC;
 				}
 			}
+			/* constant velocity part of a move - follow the feed override */
+			else if(mp != NULL)
+			{
+				long double target = _cruise(mp, _overridden(mp->velocity));
+				_Bool leaving = false;
+
+				/* jogging follows the commanded velocity instead. a reversal, a hold or a quit ramps down to the starting speed first */
+				if(jog_direction != 0)
+				{
+					int32_t cmd = jog_command();
+
+					leaving = (jog_quit_requested() == true || cmd == 0 || (cmd > 0) != (jog_direction > 0));
+					target = (leaving == true) ? mp->starting_speed : fmaxl(mp->starting_speed, _cruise(mp, _overridden(abs(cmd))));
+				}
+
+				/* speed changes stay under the -T curve, and cross resonance bands at the band's acceleration (see resonance.h) */
+				if(cur_freq < target)
+				{
+					cur_freq = fminl(target, cur_freq + ((resonance_accel(cur_freq, accel_curve_limit(cur_freq, mp->acc))/NSEC_PER_SEC)*pulse_width));
+				}
+				else if(cur_freq > target)
+				{
+					cur_freq = fmaxl(target, cur_freq - ((resonance_accel(cur_freq, accel_curve_limit(cur_freq, mp->dec))/NSEC_PER_SEC)*pulse_width));
+				}
+
+				pulse_width = ((1.0/cur_freq)/2.0)*NSEC_PER_SEC;
+
+				/* the jog segment ends between steps once it is slow enough to stop or reverse */
+				if(leaving == true && should_pulse == 1 && cur_freq <= mp->starting_speed)
+				{
+					last_freq = cur_freq;
+					_advance(pulse_width);
+					_write_output(LOW);
+					perf_edge_end();
+					return 0;
+				}
+
+				/* re-plan the decel start: faster than planned means we need more room to stop - more still where the -T curve is low */
+				if(jog_direction == 0 && should_pulse == 1 && cur_freq > mp->velocity && accel_curve_distance(mp->starting_speed, cur_freq, mp->dec) >= (mp->num_steps - (int64_t)*motor_pos))
+				{
+					last_freq = cur_freq;
+					_advance(pulse_width);
+					perf_edge_end();
+					return 0;
+				}
+			}
 
-			/* after pulsing is done, check to see if we have hit the stop limit */
-			if(stop_point != NULL && *motor_pos == *stop_point)
+			if(cur_freq > peak_freq)
 			{
+				peak_freq = cur_freq;
+			}
+
+			/**
+			 * after pulsing is done, check to see if we have hit the stop limit. The last step is finished first - its low
+			 * half too - and t is left at the deadline of the next step, so the next phase keeps the step spacing
+			 **/
+			if(stop_point != NULL && *motor_pos >= *stop_point && should_pulse == 1)
+			{
+				last_freq = cur_freq;
+				_advance(pulse_width);
+
 				/* reset output to low state */
 				printf("\nMOTOR_POS: %"PRId64"\n", *motor_pos);
 				printf("\nFINAL FREQ: %LFs\n", cur_freq);
 				printf("\nMOVE TIME: %LFs\n", (stop_time/NSEC_PER_SEC));
-				digitalWrite(WIRINGPI_PULSE_OUTPUT, LOW);
+				_write_output(LOW);
+				perf_edge_end();
 				return 0;
 			}
 
 			stop_time += pulse_width;
-			t.tv_nsec += pulse_width;
-			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+			_advance(pulse_width);
+
+			/**
+			 * t is the ideal timeline. While we are behind it, the catch-up policy schedules the next edge no sooner than
+			 * one catch-up half period after the last one, so the drive sees at most CATCHUP_MAX_FREQ instead of a burst.
+			 **/
+			deadline = t;
+
+			if(behind == true)
+			{
+				struct timespec earliest = now;
+				earliest.tv_nsec += catchup_width;
+				tsnorm(&earliest);
+
+				if(_ts_diff_ns(&earliest, &deadline) > 0)
+				{
+					deadline = earliest;
+					overruns.caught_up++;
+				}
+				else
+				{
+					behind = false;
+				}
+			}
+
+			perf_edge_end();
+			timebase_sleep_until(&deadline);
+			timebase_now(&now);
+			late_ns = _ts_diff_ns(&now, &deadline);
+
+			/* an overrun is waking up more than half an edge interval late - the drive would see a pulse less than half as wide as planned */
+			if(late_ns > (pulse_width / 2))
+			{
+				overruns.detected++;
+
+				if(OVERRUN_POLICY == overrun_catchup)
+				{
+					behind = true;
+				}
+				else if(OVERRUN_POLICY == overrun_reanchor)
+				{
+					/* shift the rest of the timeline by the overrun, the move just takes longer */
+					t = now;
+					t_frac = 0;
+					overruns.reanchored++;
+				}
+				else if(OVERRUN_POLICY == overrun_abort && stop_reason == 0)
+				{
+					fprintf(stdout, "\n!!!ERROR: Deadline overrun of %" PRId64 "ns, stopping!\n", late_ns);
+					telemetry_publish_estop();
+					overruns.aborted++;
+					stop_reason = PULSE_ERR_OVERRUN;
+				}
+			}
 
-			tsnorm(&t);
+			telemetry_publish_edge(*motor_pos, cur_freq, late_ns);
 		}	
 	}
 	/* no move - just return success */
@@ -13,10 +13,40 @@
 #include <stdio.h>
 
 #include "motion_control.h"
+#include "planner.h"
+#include "replay.h"
+
+/**
+ * DEADLINE OVERRUNS
+ * After every edge the pulse loop checks how late it woke up. Waking more than half an edge interval late is an overrun,
+ * and OVERRUN_POLICY (-p) decides what happens next:
+ * overrun_catchup: keep the original timeline, but never issue edges faster than CATCHUP_MAX_FREQ while catching up to it
+ * overrun_reanchor: restart the timeline from the late wakeup. No burst, the move takes longer by the overrun
+ * overrun_abort: decelerate to a stop (see stop_request.h) and report PULSE_ERR_OVERRUN
+ **/
+enum overrun_policy {overrun_catchup, overrun_reanchor, overrun_abort};
+
+struct overrun_stats
+{
+	uint64_t detected;		/* edges that woke up late */
+	uint64_t caught_up;		/* edges held back to the catch-up rate */
+	uint64_t reanchored;	/* timeline restarts */
+	uint64_t aborted;		/* moves stopped */
+};
+
+/* resets the per move counters - the overruns and the peak frequency */
+void pulse_reset_overruns(void);
+struct overrun_stats pulse_overruns(void);
+
+/* the highest pulse frequency of the current move, in Hz */
+long double pulse_peak_freq(void);
+
+/* prints the counters if there were any overruns, or always in verbose mode */
+void pulse_print_overruns(void);
 
 /**
  * PULSE TRAIN OPERATION
- * This will send out a pulse of a certain frequency until the user exits with ctrl-c or stop_point is reached.
+ * This will send out a pulse of a certain frequency until the user stops it with ctrl-c or stop_point is reached.
  * freq: pulse frequency in Hz. If a_rate is specified, this is the starting_speed for the acceleration ramp!!
  * *a_rate: acceleration rate in steps/s/s. NULL if using constant velocity profile
  * *stop_point: stopping point in steps. If NULL, program assumes infinite move.
@@ -24,13 +54,57 @@
 **/
 int8_t pulse_train(const int32_t freq, const int64_t *stop_point, uint64_t *motor_pos);
 
+/**
+ * SWEEP OPERATION
+ * Pulses out a frequency sweep planned with plan_sweep() (planner.h), from step 0 to the end of the schedule.
+ * sp: the sweep that was planned, for the messages
+ * *motor_pos: current motor position (updated to the caller)
+ **/
+int8_t pulse_sweep(const struct sweep_params *sp, const struct step_schedule *sweep, uint64_t *motor_pos);
+
 /** 
  * ACC/DEC OPERATION
  * Calculates an acceleration or deceleration ramp for a Trapezoidal move and executes it.
  * move_params: the move parameters as specified by the user.
  * stop_point: stopping point in steps. effectively either the acceleration stop point or mp->num_steps (deceleration)
  * motor_pos: current motor position (updated to the caller)
+ * schedule: the planned step intervals for this ramp. NULL integrates the ramp at mp.acc/mp.dec while pulsing
+ **/
+int8_t trap_acc_dec(const struct move_params mp, const int64_t stop_point, uint64_t *motor_pos, double *times, uint64_t *positions, const struct step_schedule *schedule);
+
+/**
+ * RUN OPERATION
+ * Executes the constant velocity part of a Trapezoidal move, following the feed override (see feed_override.h).
+ * move_params: the move parameters as specified by the user.
+ * stop_point: absolute position in steps where the deceleration starts. Ends earlier if the override needs more room to stop.
+ * motor_pos: current motor position (updated to the caller)
+ **/
+int8_t trap_run(const struct move_params mp, const int64_t stop_point, uint64_t *motor_pos);
+
+/**
+ * JOG OPERATION
+ * Runs the axis at the velocity commanded at runtime (see jog.h), ramping at mp.acc/mp.dec, until told to quit.
+ * mp.velocity limits the commands, mp.starting_speed is where reversals and holds stop. mp.num_steps is not used.
+ * Returns 0 once the jog was quit or stopped, or a PULSE_ERR code
+ **/
+int8_t jog(const struct move_params mp);
+
+/**
+ * FOLLOW OPERATION
+ * Slaves the axis to the gearing master (see gearing.h) until the user stops it with ctrl-c.
+ * mp.velocity, mp.acc and mp.dec limit the slave, mp.starting_speed is the slowest it steps at. mp.num_steps is not used.
+ * Returns 0 once stopped, or a PULSE_ERR code
+ **/
+int8_t follow(const struct move_params mp);
+
+/**
+ * REPLAY OPERATION
+ * Pulses out the edge timeline of a trace opened with replay_open() (replay.h), from its first edge to its last.
+ * The direction output follows the trace's direction records - r->position is the net number of steps replayed.
+ * *motor_pos: current motor position in steps issued (updated to the caller)
+ * direction: 1 CW, -1 CCW, for the steps before the first direction record - all of them in a trace from before version 3
+ * Returns 0 once replayed or stopped, or a PULSE_ERR code
  **/
-int8_t trap_acc_dec(const struct move_params mp, const int64_t stop_point, uint64_t *motor_pos, double *times, uint64_t *positions);
+int8_t pulse_replay(struct replay *r, uint64_t *motor_pos, const int8_t direction);
 
 #endif /*PULSE_TRAIN_H*/
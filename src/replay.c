@@ -0,0 +1,184 @@
+/*
+*	replay.c
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#include "replay.h"
+#include "trace.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+/* walks the whole stream once: the edges have to alternate, starting high, and never go back in time. also finds any reversal */
+static int8_t _check(struct replay *r)
+{
+	struct trace_record rec;
+	const uint8_t *p = r->start;
+	int64_t ns = 0;
+	int64_t first_ns = -1;
+	int64_t last_ns = 0;
+	uint8_t expect = TRACE_TAG_EDGE_HIGH;
+	int8_t direction = -1;
+	int8_t ret;
+
+	r->steps = 0;
+	r->reverses = false;
+
+	while((ret = trace_next_record(&p, r->end, &ns, &rec)) == 1)
+	{
+		/* a reversal is a direction record after the first edge that differs from the one before it - or that has none before it, as the steps so far went the way of -n */
+		if(rec.tag == TRACE_TAG_DIRECTION)
+		{
+			if(r->steps > 0 && (int8_t)rec.direction != direction)
+			{
+				r->reverses = true;
+			}
+
+			direction = (int8_t)rec.direction;
+			continue;
+		}
+
+		if(rec.tag != TRACE_TAG_EDGE_HIGH && rec.tag != TRACE_TAG_EDGE_LOW)
+		{
+			continue;
+		}
+
+		if(rec.tag != expect || (first_ns >= 0 && rec.ns < last_ns))
+		{
+			fprintf(stderr, "\nERROR: The trace edges don't alternate or go back in time after %" PRIu64 " steps\n", r->steps);
+			return -1;
+		}
+
+		if(first_ns < 0)
+		{
+			first_ns = rec.ns;
+		}
+
+		if(rec.tag == TRACE_TAG_EDGE_HIGH)
+		{
+			r->steps++;
+		}
+
+		last_ns = rec.ns;
+		expect = (expect == TRACE_TAG_EDGE_HIGH) ? TRACE_TAG_EDGE_LOW : TRACE_TAG_EDGE_HIGH;
+	}
+
+	if(ret < 0)
+	{
+		fprintf(stderr, "\nERROR: The trace has a corrupt record after %" PRIu64 " steps\n", r->steps);
+		return -1;
+	}
+
+	if(r->steps == 0)
+	{
+		fprintf(stderr, "\nERROR: The trace has no edges to replay\n");
+		return -1;
+	}
+
+	r->duration_ns = last_ns - first_ns;
+	return 0;
+}
+
+int8_t replay_open(const char *path, struct replay *r)
+{
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	memset(r, 0, sizeof(*r));
+
+	if(fd < 0 || fstat(fd, &st) < 0)
+	{
+		perror("\nERROR: Could not open the trace to replay");
+		return -1;
+	}
+
+	if((size_t)st.st_size < sizeof(struct trace_header))
+	{
+		fprintf(stderr, "\nERROR: %s is too short to be a trace\n", path);
+		close(fd);
+		return -1;
+	}
+
+	/* MAP_POPULATE faults every page in now, mlock() keeps them - the pulse loop reads the stream without a page fault */
+	const uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	close(fd);
+
+	if(map == MAP_FAILED)
+	{
+		perror("\nERROR: Could not map the trace to replay");
+		return -1;
+	}
+
+	r->map = map;
+	r->map_size = st.st_size;
+
+	if(mlock(map, st.st_size) != 0)
+	{
+		perror("\nERROR: Could not lock the trace to replay");
+		replay_close(r);
+		return -1;
+	}
+
+	const struct trace_header *hdr = (const struct trace_header *)map;
+
+	if(memcmp(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic)) != 0 || hdr->version < TRACE_VERSION_MIN || hdr->version > TRACE_VERSION || hdr->header_size > (uint64_t)st.st_size)
+	{
+		fprintf(stderr, "\nERROR: %s is not a version %d to %d rhubarb_motion trace\n", path, TRACE_VERSION_MIN, TRACE_VERSION);
+		replay_close(r);
+		return -1;
+	}
+
+	/* a trace from a run that never reached trace_close() has used_bytes == 0 - fall back on the zero end tag */
+	r->start = map + hdr->header_size;
+	r->end = map + st.st_size;
+
+	if(hdr->used_bytes > 0 && hdr->header_size + hdr->used_bytes <= (uint64_t)st.st_size)
+	{
+		r->end = r->start + hdr->used_bytes;
+	}
+
+	if(hdr->dropped > 0)
+	{
+		fprintf(stderr, "WARNING: %" PRIu64 " records were dropped when the trace was recorded, the replay ends where the trace filled up\n", hdr->dropped);
+	}
+
+	if(_check(r) != 0)
+	{
+		replay_close(r);
+		return -1;
+	}
+
+	replay_rewind(r);
+	return 0;
+}
+
+void replay_rewind(struct replay *r)
+{
+	r->p = r->start;
+	r->ns = 0;
+	r->edge_ns = 0;
+	r->direction = -1;
+	r->direction_changed = false;
+	r->position = 0;
+
+	/* the first edge goes out at once - only the intervals after it matter */
+	replay_next_interval(r);
+}
+
+void replay_close(struct replay *r)
+{
+	if(r->map != NULL)
+	{
+		munmap((void *)r->map, r->map_size);
+	}
+
+	memset(r, 0, sizeof(*r));
+}
@@ -0,0 +1,88 @@
+/*
+*	replay.h
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "trace.h"
+
+/**
+ * TRACE REPLAY
+ * Re-runs the edges of a binary trace (see -b and trace.h) - from the device or from a -q/rhubarb_estimate run - on the
+ * pulse output, through the same pulse loop as every other move (see pulse_replay() in pulse_train.h).
+ * The first edge goes out right away, and every edge after it follows the one before by exactly the recorded interval,
+ * including the gaps between moves. State and span records are skipped. The direction output follows the direction records
+ * (see trace.h), so a jog, follow or homing run that reverses replays its reversals too - each one lands between the same
+ * two edges as in the trace. A trace from before version 3 has no direction records, and is replayed in the direction of -n.
+ *
+ * replay_open() maps the trace with every page faulted in and locks it, and checks the whole stream up front - so the
+ * pulse loop can read the next interval straight from the mapping (replay_next_interval()) without ever faulting or failing.
+ * The lateness of every replayed edge is measured as usual, so a replay is also a benchmark of the loop on a real edge pattern.
+ **/
+
+struct replay
+{
+	const uint8_t *map;
+	size_t map_size;
+
+	/* the record stream, and the cursor the pulse loop reads from */
+	const uint8_t *start;
+	const uint8_t *end;
+	const uint8_t *p;
+	int64_t ns;
+	int64_t edge_ns;		/* time of the last edge read */
+
+	int8_t direction;			/* level of the direction output for the next edge read, -1 until a direction record is read */
+	_Bool direction_changed;	/* a direction record was read since the pulse loop last set the output */
+	int64_t position;			/* net steps replayed so far, CW positive - kept by the pulse loop */
+
+	uint64_t steps;			/* high edges in the trace */
+	int64_t duration_ns;	/* first to last edge */
+	_Bool reverses;			/* the direction changes after the first edge */
+};
+
+/* maps, locks and checks the trace at path. returns 0 on success, -1 on failure (printed) */
+int8_t replay_open(const char *path, struct replay *r);
+
+/* puts the cursor back on the first edge, past the direction records before it */
+void replay_rewind(struct replay *r);
+
+void replay_close(struct replay *r);
+
+/**
+ * The interval in ns from the last edge read to the next one, which becomes the last edge read. A direction record on
+ * the way sets direction and direction_changed. Returns -1 after the last edge. The stream was checked by replay_open(),
+ * so there are no errors to handle
+ **/
+static inline int64_t replay_next_interval(struct replay *r)
+{
+	struct trace_record rec;
+
+	while(trace_next_record(&r->p, r->end, &r->ns, &rec) == 1)
+	{
+		if(rec.tag == TRACE_TAG_DIRECTION)
+		{
+			r->direction = (rec.direction != 0) ? 1 : 0;
+			r->direction_changed = true;
+		}
+		else if(rec.tag == TRACE_TAG_EDGE_HIGH || rec.tag == TRACE_TAG_EDGE_LOW)
+		{
+			int64_t interval = rec.ns - r->edge_ns;
+			r->edge_ns = rec.ns;
+			return interval;
+		}
+	}
+
+	return -1;
+}
+
+#endif /*REPLAY_H*/
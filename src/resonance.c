@@ -0,0 +1,168 @@
+/*
+*	resonance.c
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#include "resonance.h"
+#include "globals.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+extern const int32_t MAX_FREQ;
+
+static int32_t bands = 0;
+static double low[RESONANCE_MAX_BANDS];
+static double high[RESONANCE_MAX_BANDS];
+static double acc[RESONANCE_MAX_BANDS];
+
+int8_t resonance_load(const char *path)
+{
+	FILE *fp;
+	char line[256];
+	int32_t line_no = 0;
+
+	if((fp = fopen(path, "r")) == NULL)
+	{
+		perror("\nERROR: Could not open resonance bands");
+		return -1;
+	}
+
+	bands = 0;
+
+	while(fgets(line, sizeof(line), fp) != NULL)
+	{
+		double l;
+		double h;
+		double a = 0;
+		char *p = line;
+
+		line_no++;
+		p += strspn(p, " \t");
+
+		if(*p == '#' || *p == '\n' || *p == '\r' || *p == 0)
+		{
+			continue;
+		}
+
+		int n = sscanf(p, "%lf%*[ \t,]%lf%*[ \t,]%lf", &l, &h, &a);
+
+		if(n < 2 || l <= 0 || h <= l || (n == 3 && a <= 0))
+		{
+			fprintf(stderr, "\nERROR: %s line %d: expected \"low high [acceleration]\" with low < high and a positive acceleration\n", path, line_no);
+			fclose(fp);
+			bands = 0;
+			return -1;
+		}
+
+		if(bands == RESONANCE_MAX_BANDS)
+		{
+			fprintf(stderr, "\nERROR: %s has more than %d bands\n", path, RESONANCE_MAX_BANDS);
+			fclose(fp);
+			bands = 0;
+			return -1;
+		}
+
+		if(bands > 0 && l <= high[bands - 1])
+		{
+			fprintf(stderr, "\nERROR: %s line %d: bands must increase and not overlap\n", path, line_no);
+			fclose(fp);
+			bands = 0;
+			return -1;
+		}
+
+		low[bands] = l;
+		high[bands] = h;
+		acc[bands] = (n == 3) ? a : 0;
+		bands++;
+	}
+
+	fclose(fp);
+
+	if(bands == 0)
+	{
+		fprintf(stderr, "\nERROR: %s has no bands\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+_Bool resonance_active(void)
+{
+	return bands > 0;
+}
+
+/* the band v is inside of, -1 if none. the edges themselves are allowed */
+static inline int32_t _band(const double v)
+{
+	for(int32_t i = 0; i < bands && low[i] < v; i++)
+	{
+		if(v < high[i])
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+double resonance_cruise(const double v, const double v_min, const double v_max)
+{
+	int32_t i = _band(v);
+
+	if(i < 0)
+	{
+		return v;
+	}
+
+	/* going up is only an option if the move and the pulse output can do it, going down if the motor can still start there */
+	_Bool up = (high[i] <= v_max && high[i] <= MAX_FREQ);
+	_Bool down = (low[i] >= v_min);
+
+	if(up == true && (down == false || high[i] - v < v - low[i]))
+	{
+		return high[i];
+	}
+
+	if(down == true)
+	{
+		return low[i];
+	}
+
+	return -1;
+}
+
+double resonance_accel(const double v, const double a)
+{
+	int32_t i = _band(v);
+
+	if(i < 0 || acc[i] <= a)
+	{
+		return a;
+	}
+
+	return acc[i];
+}
+
+uint64_t resonance_fingerprint(void)
+{
+	/* FNV-1a over the bands */
+	uint64_t h = 14695981039346656037ULL;
+	const uint8_t *p[3] = {(const uint8_t *)low, (const uint8_t *)high, (const uint8_t *)acc};
+
+	for(int32_t k = 0; k < 3; k++)
+	{
+		for(size_t i = 0; i < bands * sizeof(double); i++)
+		{
+			h = (h ^ p[k][i]) * 1099511628211ULL;
+		}
+	}
+
+	return (bands == 0) ? 0 : h;
+}
@@ -0,0 +1,48 @@
+/*
+*	resonance.h
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#ifndef RESONANCE_H
+#define RESONANCE_H
+
+#include <stdint.h>
+
+#define RESONANCE_MAX_BANDS 16
+
+/**
+ * RESONANCE BANDS
+ * Speed bands the axis must not dwell in, e.g. found with a sweep (-w). Loaded with -R from a text file with one
+ * "low high [acceleration]" band per line (steps/s, steps/s, steps/s^2), in increasing speed order and not overlapping.
+ * Blank lines and lines starting with # are skipped, and the values may also be separated by commas:
+ *
+ *	# low	high	acc
+ *	1800	2300	60000
+ *	7400	7700
+ *
+ * The planner never cruises inside a band: a velocity inside one is moved to the nearest edge of the band (the lower
+ * edge on a tie) - but never above -v or below -s, and a move with neither edge in between is rejected. The ramps cross
+ * a band at its acceleration if one is given - above -a/-d and the curve (-T), so only give what the motor can do at
+ * that speed - and at the normal limit otherwise. The feed override and jogging avoid the bands the same way, and only
+ * stay inside one if neither edge is allowed.
+ **/
+
+/* loads the bands. returns 0 on success, -1 on failure (the error is printed) */
+int8_t resonance_load(const char *path);
+
+/* 1 if bands were loaded */
+_Bool resonance_active(void);
+
+/* the closest velocity to v, between v_min and v_max, that is not inside a band. v itself outside a band. -1 if there is none */
+double resonance_cruise(const double v, const double v_min, const double v_max);
+
+/* the acceleration to use at speed v, given the normal limit a */
+double resonance_accel(const double v, const double a);
+
+/* identifies the loaded bands, so plans made with different bands can be told apart (see plan_cache.h). 0 without bands */
+uint64_t resonance_fingerprint(void);
+
+#endif /*RESONANCE_H*/
@@ -0,0 +1,377 @@
+/*
+*	rhubarb.c
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#define _GNU_SOURCE
+#define MAX_SAFE_STACK (100*1024)
+
+#include "rhubarb.h"
+#include "globals.h"
+#include "motion_control.h"
+#include "stop_request.h"
+#include "feed_override.h"
+#include "telemetry.h"
+#include "position.h"
+#include "perf_counters.h"
+
+#include <wiringPi.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+extern int8_t WIRINGPI_PULSE_OUTPUT;
+extern int8_t WIRINGPI_DIRECTION_OUTPUT;
+extern int8_t WIRINGPI_ESTOP_INPUT;
+extern _Bool VERBOSE;
+extern _Bool PERF_COUNTERS;
+
+/* the default SCHED_FIFO priority of the command line program (-E) */
+#define RHUBARB_DEFAULT_PRIORITY 85
+
+static pthread_t move_thread;
+static int event_fd = -1;
+
+/**
+ * the submit side and the move thread only meet here, before and after a move - never inside the pulse loop.
+ * The mutex inherits priority, so a caller holding it can't hold up the move thread behind normal priority work
+ **/
+static pthread_mutex_t lock;
+static pthread_cond_t submitted = PTHREAD_COND_INITIALIZER;
+static struct move_params pending;
+static _Bool has_pending = false;
+static _Bool quit = false;
+
+/* the last submitted move - running, its result, and whether there was one at all */
+static _Bool running = false;
+static _Bool submitted_once = false;
+static int last_result = EXIT_SUCCESS;
+
+/* the position before the running move, and the move thread's step counter while it runs */
+static int64_t base_position = 0;
+static const uint64_t *live_steps = NULL;
+static int8_t live_direction = 0;
+
+static void *_move_thread(void *arg);
+
+struct rhubarb_config rhubarb_default_config(void)
+{
+	struct rhubarb_config cfg;
+
+	cfg.pulse_output = WIRINGPI_PULSE_OUTPUT;
+	cfg.direction_output = WIRINGPI_DIRECTION_OUTPUT;
+	cfg.estop_input = WIRINGPI_ESTOP_INPUT;
+	cfg.priority = RHUBARB_DEFAULT_PRIORITY;
+	cfg.position_file = NULL;
+	cfg.telemetry_name = NULL;
+	cfg.verbose = false;
+
+	return cfg;
+}
+
+int8_t rhubarb_init(const struct rhubarb_config *cfg)
+{
+	pthread_mutexattr_t mattr;
+	pthread_attr_t attr;
+	struct sched_param param;
+	int err;
+
+	if(event_fd >= 0)
+	{
+		fprintf(stderr, "\nERROR: rhubarb_init() was already called\n");
+		return -1;
+	}
+
+	if(cfg->pulse_output != 28 && cfg->pulse_output != 29)
+	{
+		fprintf(stderr, "\nERROR: The Rhubarb can only output pulse train signals on WiringPi outputs 28 and 29\n");
+		return -1;
+	}
+
+	if(cfg->direction_output < 26 || cfg->direction_output > 29 || cfg->direction_output == cfg->pulse_output)
+	{
+		fprintf(stderr, "\nERROR: You must specify a valid output for the Rhubarb using WiringPi outputs 26, 27, 28, or 29.\n");
+		return -1;
+	}
+
+	WIRINGPI_PULSE_OUTPUT = cfg->pulse_output;
+	WIRINGPI_DIRECTION_OUTPUT = cfg->direction_output;
+	WIRINGPI_ESTOP_INPUT = cfg->estop_input;
+	VERBOSE = cfg->verbose;
+
+	wiringPiSetup();
+
+	pinMode(WIRINGPI_PULSE_OUTPUT, OUTPUT);
+	pinMode(WIRINGPI_DIRECTION_OUTPUT, OUTPUT);
+	pinMode(WIRINGPI_ESTOP_INPUT, INPUT);
+
+	pullUpDnControl(WIRINGPI_PULSE_OUTPUT, PUD_DOWN);
+	pullUpDnControl(WIRINGPI_DIRECTION_OUTPUT, PUD_DOWN);
+	pullUpDnControl(WIRINGPI_ESTOP_INPUT, PUD_DOWN);
+
+	if(cfg->telemetry_name != NULL && telemetry_init(cfg->telemetry_name) != 0)
+	{
+		return -1;
+	}
+
+	if(cfg->position_file != NULL && position_init(cfg->position_file) != 0)
+	{
+		return -1;
+	}
+
+	base_position = position_get();
+
+	/* the whole process is locked, the same as the command line program - the move thread's pages can't be swapped out */
+	if(mlockall(MCL_CURRENT|MCL_FUTURE) == -1)
+	{
+		perror("\nERROR: mlockall failed");
+		return -1;
+	}
+
+	if((event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+	{
+		perror("\nERROR: Could not create the move eventfd");
+		return -1;
+	}
+
+	pthread_mutexattr_init(&mattr);
+	pthread_mutexattr_setprotocol(&mattr, PTHREAD_PRIO_INHERIT);
+	pthread_mutex_init(&lock, &mattr);
+	pthread_mutexattr_destroy(&mattr);
+
+	quit = false;
+
+	/* the move thread is created realtime, it doesn't inherit the caller's (normal) scheduling */
+	param.sched_priority = cfg->priority;
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	pthread_attr_setschedparam(&attr, &param);
+
+	err = pthread_create(&move_thread, &attr, &_move_thread, NULL);
+	pthread_attr_destroy(&attr);
+
+	if(err != 0)
+	{
+		fprintf(stderr, "\nERROR: Could not start the realtime move thread: %s\n", strerror(err));
+		close(event_fd);
+		event_fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+int8_t rhubarb_submit(const struct move_params *mp)
+{
+	if(event_fd < 0)
+	{
+		fprintf(stderr, "\nERROR: rhubarb_init() has not been called\n");
+		return -1;
+	}
+
+	const char *invalid = move_params_check(mp);
+
+	if(invalid != NULL)
+	{
+		fprintf(stderr, "\nERROR: Invalid move: %s\n", invalid);
+		return -1;
+	}
+
+	pthread_mutex_lock(&lock);
+
+	if(running == true)
+	{
+		pthread_mutex_unlock(&lock);
+		fprintf(stderr, "\nERROR: A move is already running\n");
+		return -1;
+	}
+
+	pending = *mp;
+	pending.CW = (mp->num_steps > 0);
+	pending.CCW = (mp->num_steps < 0);
+
+	/* a stop only applies to the move it was made during */
+	stop_request_clear();
+
+	has_pending = true;
+	running = true;
+	submitted_once = true;
+
+	pthread_cond_signal(&submitted);
+	pthread_mutex_unlock(&lock);
+
+	return 0;
+}
+
+int rhubarb_event_fd(void)
+{
+	return event_fd;
+}
+
+int8_t rhubarb_poll(int *result)
+{
+	uint64_t count;
+	int8_t ret;
+
+	/* drain the eventfd, so it only turns readable again for the next move */
+	while(read(event_fd, &count, sizeof(count)) < 0 && errno == EINTR);
+
+	pthread_mutex_lock(&lock);
+
+	if(submitted_once == false)
+	{
+		ret = -1;
+	}
+	else if(running == true)
+	{
+		ret = 1;
+	}
+	else
+	{
+		*result = last_result;
+		ret = 0;
+	}
+
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+int rhubarb_wait(void)
+{
+	struct pollfd pfd = {event_fd, POLLIN, 0};
+	int result = EXIT_FAILURE;
+	int8_t ret;
+
+	while((ret = rhubarb_poll(&result)) == 1)
+	{
+		poll(&pfd, 1, -1);
+	}
+
+	return (ret == 0) ? result : -1;
+}
+
+void rhubarb_stop(void)
+{
+	stop_request_raise();
+}
+
+void rhubarb_feed_override(const int32_t percent)
+{
+	feed_override_set(percent);
+}
+
+int64_t rhubarb_position(void)
+{
+	pthread_mutex_lock(&lock);
+
+	int64_t position = base_position;
+
+	if(live_steps != NULL)
+	{
+		int64_t steps = (int64_t)__atomic_load_n(live_steps, __ATOMIC_RELAXED);
+		position += (live_direction < 0) ? -steps : steps;
+	}
+
+	pthread_mutex_unlock(&lock);
+	return position;
+}
+
+void rhubarb_close(void)
+{
+	if(event_fd < 0)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	quit = true;
+
+	if(running == true)
+	{
+		stop_request_raise();
+	}
+
+	pthread_cond_signal(&submitted);
+	pthread_mutex_unlock(&lock);
+
+	pthread_join(move_thread, NULL);
+	pthread_mutex_destroy(&lock);
+
+	close(event_fd);
+	event_fd = -1;
+}
+
+static void *_move_thread(void *arg)
+{
+	/* prefault the stack, as rt_setup() does for the command line program */
+	unsigned char dummy[MAX_SAFE_STACK];
+	memset(dummy, 0, MAX_SAFE_STACK);
+
+	/* the counters count the thread that opens them */
+	if(PERF_COUNTERS == true)
+	{
+		perf_counters_init();
+	}
+
+	pthread_mutex_lock(&lock);
+
+	for(;;)
+	{
+		while(has_pending == false && quit == false)
+		{
+			pthread_cond_wait(&submitted, &lock);
+		}
+
+		if(quit == true)
+		{
+			break;
+		}
+
+		struct move_params mp = pending;
+		has_pending = false;
+
+		/* publish this thread's step counter for rhubarb_position() */
+		live_direction = (mp.CCW == 1) ? -1 : 1;
+		live_steps = move_position();
+		pthread_mutex_unlock(&lock);
+
+		/* for the AMCI SD7540, a HIGH output is CW */
+		digitalWrite(WIRINGPI_DIRECTION_OUTPUT, (mp.CW == 1) ? 1 : 0);
+
+		int result = execute_move(&mp);
+
+		pthread_mutex_lock(&lock);
+
+		/* the position file already has the move in it - without one, add the steps actually issued */
+		if(position_active() == true)
+		{
+			base_position = position_get();
+		}
+		else
+		{
+			int64_t steps = (int64_t)*live_steps;
+			base_position += (live_direction < 0) ? -steps : steps;
+		}
+
+		live_steps = NULL;
+		last_result = result;
+		running = false;
+
+		uint64_t one = 1;
+		while(write(event_fd, &one, sizeof(one)) < 0 && errno == EINTR);
+	}
+
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
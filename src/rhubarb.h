@@ -0,0 +1,90 @@
+/*
+*	rhubarb.h
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#ifndef RHUBARB_H
+#define RHUBARB_H
+
+#include <stdint.h>
+
+#include "motion_control.h"
+
+/**
+ * LIBRARY API
+ * The motion engine without the command line, for driving moves from another program in the same process.
+ * build.sh builds it as librhubarb.so - link with -lrhubarb -lwiringPi -lrt -lm -lbsd -lpthread.
+ *
+ * rhubarb_init() sets up the I/O and starts an internal realtime thread (SCHED_FIFO), which runs every move.
+ * rhubarb_submit() hands a move to that thread and returns at once. The caller then either:
+ *	- adds rhubarb_event_fd() to its own poll/epoll/select loop - it becomes readable when the move ends - and calls rhubarb_poll(), or
+ *	- blocks in rhubarb_wait()
+ * Only one move runs at a time. The library does not install any signal handlers - use rhubarb_stop() instead of Ctrl-C.
+ *
+ *	struct rhubarb_config cfg = rhubarb_default_config();
+ *	struct move_params mp = init_move_params();
+ *
+ *	mp.starting_speed = 100; mp.steps_per_rev = 400; mp.acc = 2000; mp.dec = 2000; mp.velocity = 1000; mp.num_steps = -800;
+ *
+ *	rhubarb_init(&cfg);
+ *	rhubarb_submit(&mp);
+ *	int result = rhubarb_wait();
+ *	rhubarb_close();
+ *
+ * The options that have no field in struct rhubarb_config keep their command line defaults.
+ **/
+
+struct rhubarb_config
+{
+	int8_t pulse_output;			/* WiringPi pulse output, 28 or 29 (-g) */
+	int8_t direction_output;		/* WiringPi direction output, 26 - 29 (-z) */
+	int8_t estop_input;				/* WiringPi e-stop input (-x) */
+	int32_t priority;				/* SCHED_FIFO priority of the move thread */
+	const char *position_file;		/* absolute position state file (-l), NULL for none */
+	const char *telemetry_name;		/* telemetry shared memory name (-m), NULL for none */
+	_Bool verbose;					/* -y */
+};
+
+/* the command line defaults */
+struct rhubarb_config rhubarb_default_config(void);
+
+/* sets up the I/O, locks memory and starts the move thread. call once. returns 0 on success, -1 on failure (printed) */
+int8_t rhubarb_init(const struct rhubarb_config *cfg);
+
+/**
+ * Starts a move on the move thread and returns without waiting for it. The sign of mp->num_steps is the direction.
+ * Returns 0 if the move was accepted, -1 if a move is already running or a parameter is outside the command line limits (printed)
+ **/
+int8_t rhubarb_submit(const struct move_params *mp);
+
+/* an eventfd that becomes readable when a submitted move ends. don't read it yourself - rhubarb_poll() does */
+int rhubarb_event_fd(void);
+
+/**
+ * Checks on the last submitted move without blocking.
+ * Returns 1 while it runs, 0 once it has ended (*result is then EXIT_SUCCESS or EXIT_FAILURE), -1 if no move was submitted
+ **/
+int8_t rhubarb_poll(int *result);
+
+/* blocks until the last submitted move ends. returns EXIT_SUCCESS or EXIT_FAILURE, or -1 if no move was submitted */
+int rhubarb_wait(void);
+
+/* stops the running move with a controlled deceleration (STOP_DECEL, default the move's dec) - the move then ends with EXIT_FAILURE. a second call stops at once */
+void rhubarb_stop(void);
+
+/* feed rate override of the running and later moves, in percent (see feed_override.h) */
+void rhubarb_feed_override(const int32_t percent);
+
+/**
+ * The axis position in steps, CW positive, updated live while a move runs.
+ * With a position file this is the absolute position, otherwise it counts from where the axis was at rhubarb_init()
+ **/
+int64_t rhubarb_position(void);
+
+/* stops any move, ends the move thread and releases the eventfd */
+void rhubarb_close(void);
+
+#endif /*RHUBARB_H*/
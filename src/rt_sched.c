@@ -0,0 +1,158 @@
+/*
+*	rt_sched.c
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#define _GNU_SOURCE
+
+#include "rt_sched.h"
+#include "globals.h"
+
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <errno.h>
+#include <inttypes.h>
+
+extern _Bool VERBOSE;
+extern int8_t SCHED_POLICY;
+extern int32_t SCHED_PRIORITY;
+extern int32_t SCHED_RUNTIME_US;
+extern int32_t SCHED_PERIOD_US;
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+
+#ifndef SCHED_FLAG_RESET_ON_FORK
+#define SCHED_FLAG_RESET_ON_FORK 0x01
+#endif
+
+/* glibc has no wrapper or struct for sched_setattr() */
+struct rt_sched_attr
+{
+	uint32_t size;
+	uint32_t sched_policy;
+	uint64_t sched_flags;
+	int32_t sched_nice;
+	uint32_t sched_priority;
+	uint64_t sched_runtime;
+	uint64_t sched_deadline;
+	uint64_t sched_period;
+};
+
+int8_t rt_sched_parse(const char *arg)
+{
+	int priority = 0;
+	int runtime = 0;
+	int period = 0;
+
+	if(strcmp(arg, "fifo") == 0)
+	{
+		SCHED_POLICY = rt_sched_fifo;
+	}
+	else if(sscanf(arg, "fifo:%d", &priority) == 1)
+	{
+		if(priority < sched_get_priority_min(SCHED_FIFO) || priority > sched_get_priority_max(SCHED_FIFO))
+		{
+			printf("\nERROR: SCHED_FIFO priority must be between %d and %d\n", sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO));
+			return -1;
+		}
+
+		SCHED_POLICY = rt_sched_fifo;
+		SCHED_PRIORITY = priority;
+	}
+	else if(strcmp(arg, "deadline") == 0)
+	{
+		SCHED_POLICY = rt_sched_deadline;
+	}
+	else if(sscanf(arg, "deadline:%d:%d", &runtime, &period) == 2)
+	{
+		if(runtime <= 0 || period <= 0 || runtime > period)
+		{
+			printf("\nERROR: SCHED_DEADLINE runtime and period must be greater than 0, with the runtime no longer than the period\n");
+			return -1;
+		}
+
+		SCHED_POLICY = rt_sched_deadline;
+		SCHED_RUNTIME_US = runtime;
+		SCHED_PERIOD_US = period;
+	}
+	else
+	{
+		printf("\nERROR: The scheduler must be fifo[:priority] or deadline[:runtime_us:period_us]\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int8_t rt_sched_apply(const double step_rate)
+{
+	if(SCHED_POLICY == rt_sched_fifo)
+	{
+		struct sched_param param;
+		param.sched_priority = SCHED_PRIORITY;
+
+		if(sched_setscheduler(0, SCHED_FIFO, &param) == -1)
+		{
+			perror("Could not set scheduler");
+			return -1;
+		}
+
+		if(VERBOSE == true)
+		{
+			printf("Scheduler:\t\t\t\tSCHED_FIFO priority %d\n", SCHED_PRIORITY);
+		}
+
+		return 0;
+	}
+
+	struct rt_sched_attr attr;
+	uint64_t runtime = (uint64_t)SCHED_RUNTIME_US * 1000;
+	uint64_t period = (uint64_t)SCHED_PERIOD_US * 1000;
+
+	if(period == 0)
+	{
+		double edge_ns = NSEC_PER_SEC / (2.0 * ((step_rate > 0) ? step_rate : MAX_FREQ));
+
+		period = (edge_ns > DEADLINE_MIN_PERIOD_NS) ? (uint64_t)edge_ns : DEADLINE_MIN_PERIOD_NS;
+		runtime = (uint64_t)ceil(period / edge_ns) * DEADLINE_EDGE_RUNTIME_NS;
+
+		if(runtime > period * DEADLINE_MAX_UTILIZATION)
+		{
+			runtime = period * DEADLINE_MAX_UTILIZATION;
+			fprintf(stderr, "\nWARNING: %.0f steps/s needs more than %.0f%% of a CPU under SCHED_DEADLINE - edges may be late\n", step_rate, DEADLINE_MAX_UTILIZATION * 100);
+		}
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.sched_policy = SCHED_DEADLINE;
+
+	/* a deadline task can't start threads at all unless they drop back to normal scheduling */
+	attr.sched_flags = SCHED_FLAG_RESET_ON_FORK;
+	attr.sched_runtime = runtime;
+	attr.sched_deadline = period;
+	attr.sched_period = period;
+
+	if(syscall(SYS_sched_setattr, 0, &attr, 0) == -1)
+	{
+		/* EBUSY: the reservation doesn't fit in what the kernel admits for deadline tasks (sched_rt_runtime_us) */
+		fprintf(stderr, "\nERROR: Could not set SCHED_DEADLINE (runtime %" PRIu64 "ns, period %" PRIu64 "ns): %s\n", runtime, period, strerror(errno));
+		return -1;
+	}
+
+	if(VERBOSE == true)
+	{
+		printf("Scheduler:\t\t\t\tSCHED_DEADLINE runtime %" PRIu64 "ns every %" PRIu64 "ns\n", runtime, period);
+	}
+
+	return 0;
+}
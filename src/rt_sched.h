@@ -0,0 +1,42 @@
+/*
+*	rt_sched.h
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#ifndef RT_SCHED_H
+#define RT_SCHED_H
+
+#include <stdint.h>
+
+/**
+ * REALTIME SCHEDULING
+ * The thread that runs the pulse loop is scheduled with one of (see -E):
+ *
+ *	rt_sched_fifo:		SCHED_FIFO at SCHED_PRIORITY (default 85). Runs whenever it is ready, unless a higher priority thread is
+ *	rt_sched_deadline:	SCHED_DEADLINE. The kernel guarantees SCHED_RUNTIME_US of CPU every SCHED_PERIOD_US, ahead of any FIFO
+ *						thread, and never gives it more - it can't starve the other services on the box
+ *
+ * Unless given, the deadline reservation is derived from the fastest step rate of the run: the period is the time between
+ * two edges at that rate, but at least DEADLINE_MIN_PERIOD_NS, and the runtime is DEADLINE_EDGE_RUNTIME_NS for every edge
+ * in a period, at most DEADLINE_MAX_UTILIZATION of it. Threads started later (jog, encoder) fall back to normal scheduling.
+ *
+ * Either way the loop can sleep in clock_nanosleep() or on a timerfd (-N, see timebase.h), and the lateness of every
+ * wakeup is measured the same way - overruns, -b traces, -m telemetry and -I counters all work with every combination.
+ **/
+
+enum rt_sched_policy {rt_sched_fifo, rt_sched_deadline};
+
+#define DEADLINE_MIN_PERIOD_NS 100000
+#define DEADLINE_EDGE_RUNTIME_NS 20000
+#define DEADLINE_MAX_UTILIZATION 0.9
+
+/* parses fifo[:priority] or deadline[:runtime_us:period_us] into the globals. returns 0 on success, -1 on failure (printed) */
+int8_t rt_sched_parse(const char *arg);
+
+/* schedules the calling thread. step_rate is the fastest step rate of the run in steps/s. returns 0 on success, -1 on failure (printed) */
+int8_t rt_sched_apply(const double step_rate);
+
+#endif /*RT_SCHED_H*/
@@ -0,0 +1,121 @@
+/*
+*	state_machine.c
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#include "state_machine.h"
+#include "globals.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "perf_counters.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+extern _Bool VERBOSE;
+
+int8_t sm_register(struct sm_profile *profile, const struct sm_transition *transitions, const size_t count)
+{
+	if(profile->state_count > SM_MAX_STATES || profile->initial < 0 || profile->initial >= profile->state_count)
+	{
+		fprintf(stderr, "\nERROR: Profile %s has more than %d states or a bad initial state\n", profile->name, SM_MAX_STATES);
+		return -1;
+	}
+
+	memset(profile->next, -1, sizeof(profile->next));
+
+	for(size_t i = 0; i < count; i++)
+	{
+		const struct sm_transition *t = &transitions[i];
+
+		if(t->src_state < 0 || t->src_state >= profile->state_count || t->dst_state < 0 || t->dst_state >= profile->state_count || t->ret_code >= SM_RET_CODES)
+		{
+			fprintf(stderr, "\nERROR: Profile %s has a transition out of range\n", profile->name);
+			return -1;
+		}
+
+		profile->next[t->src_state][t->ret_code] = t->dst_state;
+	}
+
+	/* a state that doesn't end the profile must lead somewhere whatever it returns */
+	for(int8_t s = 0; s < profile->state_count; s++)
+	{
+		for(int8_t rc = 0; rc < SM_RET_CODES && profile->states[s].final == false; rc++)
+		{
+			if(profile->next[s][rc] < 0)
+			{
+				fprintf(stderr, "\nERROR: Profile %s has no transition from state %s for return code %d\n", profile->name, profile->states[s].name, rc);
+				return -1;
+			}
+		}
+	}
+
+	profile->registered = true;
+	return 0;
+}
+
+int sm_run(const struct sm_profile *profile)
+{
+	/*
+	 * current_state = the state the machine is currently in
+	 * rc = the return code of the state that just ran, which together with current_state picks the next state
+	 */
+	int8_t current_state = profile->initial;
+	int rc;
+
+	assert(profile->registered == true);
+
+	if(profile->publish == true)
+	{
+		trace_state(current_state);
+	}
+
+	for(;;)
+	{
+		const struct sm_state *s = &profile->states[current_state];
+
+		if(profile->publish == true)
+		{
+			telemetry_publish_state(current_state);
+			perf_phase_begin();
+		}
+
+		rc = s->run();
+
+		if(profile->publish == true)
+		{
+			perf_phase_end(current_state);
+		}
+
+		/* the calling function prints the error message of a failed profile */
+		if(s->final == true)
+		{
+			return (s->failed == true) ? EXIT_FAILURE : EXIT_SUCCESS;
+		}
+
+		/* a state returning something that isn't a return code is a bug in the state, not something to recover from */
+		assert(rc >= 0 && rc < SM_RET_CODES);
+
+		int8_t next_state = profile->next[current_state][rc];
+
+		if(next_state != current_state)
+		{
+			if(profile->publish == true)
+			{
+				trace_state(next_state);
+			}
+
+			if(VERBOSE == true)
+			{
+				fprintf(stderr, "\nTransitioning to state: %s\n", profile->states[next_state].name);
+			}
+		}
+
+		current_state = next_state;
+	}
+}
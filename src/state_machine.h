@@ -0,0 +1,73 @@
+/*
+*	state_machine.h
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#ifndef STATE_MACHINE_H
+#define STATE_MACHINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SM_MAX_STATES 16
+
+/**
+ * STATE MACHINE ENGINE
+ * Every move type - a profile - is a set of states and the transitions between them, run by the same engine.
+ *
+ * A state is a function that takes no arguments and returns one of the return codes below. It does the work of the
+ * state (usually a call into the pulse loop) and nothing else - where to go next is up to the profile's transitions.
+ * Transitions are written as a list of (state, return code, next state), straight from the state diagram.
+ * sm_register() turns the list into a dense [state][return code] matrix once, so finding the next state is a
+ * single load, and checks that every state that doesn't end the profile has a next state for every return code.
+ *
+ * A state marked final ends the profile after it runs - failed says whether the profile then failed.
+ * A profile that publishes its states (publish = 1, the trapezoid) reports them to telemetry, the trace and the
+ * performance counters as state codes - the index into its states - so readers can decode them with enum state_codes.
+ **/
+enum sm_ret_codes {sm_done, sm_fail, sm_repeat, sm_stop, SM_RET_CODES};
+
+struct sm_state
+{
+	const char *name;
+	int (*run)(void);
+	_Bool final;
+	_Bool failed;
+};
+
+struct sm_transition
+{
+	int8_t src_state;
+	enum sm_ret_codes ret_code;
+	int8_t dst_state;
+};
+
+struct sm_profile
+{
+	const char *name;
+	const struct sm_state *states;
+	int8_t state_count;
+	int8_t initial;
+	_Bool publish;
+
+	/* filled in by sm_register() */
+	int8_t next[SM_MAX_STATES][SM_RET_CODES];
+	_Bool registered;
+};
+
+/**
+ * Builds the transition matrix of a profile from its transition list.
+ * Returns 0 on success, -1 if the profile has too many states or a transition is missing or out of range (printed)
+ **/
+int8_t sm_register(struct sm_profile *profile, const struct sm_transition *transitions, const size_t count);
+
+/**
+ * Runs a registered profile from its initial state until a final state has run.
+ * Returns EXIT_SUCCESS, or EXIT_FAILURE if the final state is a failed one
+ **/
+int sm_run(const struct sm_profile *profile);
+
+#endif /*STATE_MACHINE_H*/
@@ -0,0 +1,63 @@
+/*
+*	stop_request.c
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#include "stop_request.h"
+
+#include <signal.h>
+#include <string.h>
+#include <stdio.h>
+
+/* the number of stop signals received. sig_atomic_t is all a handler may safely touch */
+static volatile sig_atomic_t requests = 0;
+
+static void _stop_signal(int sig);
+
+int8_t stop_request_init(void)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = &_stop_signal;
+	sigemptyset(&sa.sa_mask);
+
+	if(sigaction(SIGINT, &sa, NULL) < 0 || sigaction(SIGTERM, &sa, NULL) < 0)
+	{
+		perror("\nERROR: Could not install stop handlers");
+		return -1;
+	}
+
+	return 0;
+}
+
+_Bool stop_requested(void)
+{
+	return requests > 0;
+}
+
+_Bool stop_requested_now(void)
+{
+	return requests > 1;
+}
+
+void stop_request_raise(void)
+{
+	_stop_signal(0);
+}
+
+void stop_request_clear(void)
+{
+	requests = 0;
+}
+
+static void _stop_signal(int sig)
+{
+	if(requests < 2)
+	{
+		requests++;
+	}
+}
@@ -0,0 +1,36 @@
+/*
+*	stop_request.h
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#ifndef STOP_REQUEST_H
+#define STOP_REQUEST_H
+
+#include <stdint.h>
+
+/**
+ * CONTROLLED STOP
+ * SIGINT (Ctrl-C) and SIGTERM no longer kill the process mid-pulse. The handlers only set a flag, and the pulse loop
+ * turns whatever it is doing into a deceleration to stop at STOP_DECEL (-S, default: the move's -d), leaves the
+ * pulse output low and reports the final motor position. A second signal stops immediately, still with the output low.
+ **/
+
+/* installs the SIGINT/SIGTERM handlers. returns 0 on success, -1 on failure */
+int8_t stop_request_init(void);
+
+/* 1 once a stop was requested */
+_Bool stop_requested(void);
+
+/* 1 if a stop was requested again while already stopping - skip the decel */
+_Bool stop_requested_now(void);
+
+/* requests a stop without a signal, as a signal would - e.g. from the library API (see rhubarb.h) */
+void stop_request_raise(void);
+
+/* forgets any pending request, e.g. before the next move */
+void stop_request_clear(void);
+
+#endif /*STOP_REQUEST_H*/
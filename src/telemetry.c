@@ -0,0 +1,155 @@
+/*
+*	telemetry.c
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#include "telemetry.h"
+#include "globals.h"
+#include "encoder.h"
+#include "feed_override.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+
+static struct telemetry *seg = NULL;
+
+static inline void _write_begin(void)
+{
+	__atomic_store_n(&seg->seq, seg->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void _write_end(void)
+{
+	__atomic_store_n(&seg->seq, seg->seq + 1, __ATOMIC_RELEASE);
+}
+
+int8_t telemetry_init(const char *name)
+{
+	int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+
+	if(fd < 0)
+	{
+		perror("\nERROR: Could not open telemetry segment");
+		return -1;
+	}
+
+	if(ftruncate(fd, sizeof(struct telemetry)) < 0)
+	{
+		perror("\nERROR: Could not size telemetry segment");
+		close(fd);
+		return -1;
+	}
+
+	void *p = mmap(NULL, sizeof(struct telemetry), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if(p == MAP_FAILED)
+	{
+		perror("\nERROR: Could not map telemetry segment");
+		return -1;
+	}
+
+	/* the segment outlives us so readers can see how the last move ended - so make it odd while we reset it. seq can
+	 * already be odd if the last writer died mid-update, so set the bit rather than count, and _write_end() makes it even
+	 */
+	seg = p;
+	__atomic_store_n(&seg->seq, seg->seq | 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	seg->magic = TELEMETRY_MAGIC;
+	seg->version = TELEMETRY_VERSION;
+	seg->state = 0;
+	seg->estop = 0;
+	seg->direction = 1;
+	seg->motor_pos = 0;
+	seg->freq = 0;
+	seg->feed_override = feed_override_percent();
+	seg->following_error = 0;
+	seg->jitter_last_ns = 0;
+	seg->jitter_max_ns = 0;
+	seg->jitter_sum_ns = 0;
+	seg->jitter_samples = 0;
+	_write_end();
+
+	return 0;
+}
+
+_Bool telemetry_active(void)
+{
+	return seg != NULL;
+}
+
+void telemetry_publish_move(const int8_t direction)
+{
+	if(seg == NULL)
+	{
+		return;
+	}
+
+	_write_begin();
+	seg->direction = direction;
+	seg->estop = 0;
+	seg->motor_pos = 0;
+	seg->freq = 0;
+	seg->feed_override = feed_override_percent();
+	seg->following_error = 0;
+	seg->jitter_last_ns = 0;
+	seg->jitter_max_ns = 0;
+	seg->jitter_sum_ns = 0;
+	seg->jitter_samples = 0;
+	_write_end();
+}
+
+void telemetry_publish_state(const int32_t state)
+{
+	if(seg == NULL)
+	{
+		return;
+	}
+
+	_write_begin();
+	seg->state = state;
+	_write_end();
+}
+
+void telemetry_publish_edge(const uint64_t motor_pos, const double freq, const int64_t late_ns)
+{
+	if(seg == NULL)
+	{
+		return;
+	}
+
+	_write_begin();
+	seg->motor_pos = motor_pos;
+	seg->freq = freq;
+	seg->following_error = encoder_following_error();
+	seg->feed_override = feed_override_percent();
+	seg->jitter_last_ns = late_ns;
+	seg->jitter_sum_ns += late_ns;
+	seg->jitter_samples++;
+
+	if(late_ns > seg->jitter_max_ns)
+	{
+		seg->jitter_max_ns = late_ns;
+	}
+	_write_end();
+}
+
+void telemetry_publish_estop(void)
+{
+	if(seg == NULL)
+	{
+		return;
+	}
+
+	_write_begin();
+	seg->estop = 1;
+	_write_end();
+}
@@ -0,0 +1,76 @@
+/*
+*	telemetry.h
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+
+#define TELEMETRY_MAGIC 0x52484254	/* "RHBT" */
+#define TELEMETRY_VERSION 1
+
+/**
+ * LIVE TELEMETRY
+ * The axis state is published into a POSIX shared memory segment (see -m) while a move runs.
+ * There is exactly one writer - the pulse loop thread - and any number of readers.
+ *
+ * The segment is guarded by a sequence lock: the writer makes seq odd, updates the fields, and makes seq even again.
+ * The writer never waits on a reader. Readers copy the segment and retry if seq was odd or changed under them,
+ * which is what telemetry_read() below does. Readers map the segment read-only and never make a syscall to poll it.
+ **/
+struct telemetry
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t seq;
+
+	int32_t state;				/* enum state_codes */
+	uint8_t estop;				/* 1 once an e-stop or following error stopped the move */
+	int8_t direction;			/* 1 CW, -1 CCW */
+
+	uint64_t motor_pos;			/* steps issued in the current move */
+	double freq;				/* current pulse frequency in Hz */
+	int32_t feed_override;		/* percent */
+	int64_t following_error;	/* steps, 0 without encoder feedback */
+
+	/* wakeup lateness of the pulse loop, in ns */
+	int64_t jitter_last_ns;
+	int64_t jitter_max_ns;
+	int64_t jitter_sum_ns;
+	uint64_t jitter_samples;
+};
+
+/* creates (or re-uses) and maps the named segment. returns 0 on success, -1 on failure */
+int8_t telemetry_init(const char *name);
+
+/* 1 if telemetry_init() succeeded */
+_Bool telemetry_active(void);
+
+/* writer side - all of these return immediately if telemetry is not active */
+void telemetry_publish_move(const int8_t direction);
+void telemetry_publish_state(const int32_t state);
+void telemetry_publish_edge(const uint64_t motor_pos, const double freq, const int64_t late_ns);
+void telemetry_publish_estop(void);
+
+/* reader side - takes a consistent snapshot of a mapped segment */
+static inline void telemetry_read(const struct telemetry *seg, struct telemetry *out)
+{
+	uint32_t s0;
+	uint32_t s1;
+
+	do
+	{
+		s0 = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE);
+		*out = *seg;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		s1 = __atomic_load_n(&seg->seq, __ATOMIC_RELAXED);
+	}
+	while((s0 & 1) || s0 != s1);
+}
+
+#endif /*TELEMETRY_H*/
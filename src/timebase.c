@@ -0,0 +1,123 @@
+/*
+*	timebase.c
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#include "timebase.h"
+#include "globals.h"
+#include "watchdog.h"
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <stdbool.h>
+
+static __thread _Bool use_virtual = false;
+static __thread struct timespec virtual_now;
+static __thread int64_t virtual_estop_ns = -1;
+static __thread int timer_fd = -1;
+
+void timebase_use_virtual(void)
+{
+	use_virtual = true;
+	virtual_now.tv_sec = 0;
+	virtual_now.tv_nsec = 0;
+}
+
+_Bool timebase_virtual(void)
+{
+	return use_virtual;
+}
+
+int8_t timebase_use_timerfd(void)
+{
+	if(timer_fd >= 0)
+	{
+		return 0;
+	}
+
+	if((timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0)
+	{
+		perror("\nERROR: Could not create the timerfd");
+		return -1;
+	}
+
+	return 0;
+}
+
+_Bool timebase_timerfd(void)
+{
+	return timer_fd >= 0;
+}
+
+int timebase_now(struct timespec *ts)
+{
+	if(use_virtual == true)
+	{
+		*ts = virtual_now;
+		return 0;
+	}
+
+	return clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+int timebase_sleep_until(const struct timespec *deadline)
+{
+	int ret;
+
+	if(use_virtual == true)
+	{
+		/* a deadline in the past wakes up right away, like the real clock */
+		if(deadline->tv_sec > virtual_now.tv_sec || (deadline->tv_sec == virtual_now.tv_sec && deadline->tv_nsec > virtual_now.tv_nsec))
+		{
+			virtual_now = *deadline;
+		}
+
+		return 0;
+	}
+
+	/* while the watchdog watches this thread, every sleep is a heartbeat */
+	watchdog_beat(deadline);
+
+	if(timer_fd >= 0)
+	{
+		/* an expiry already in the past fires at once, like clock_nanosleep() */
+		struct itimerspec its = {{0, 0}, *deadline};
+		uint64_t expirations;
+
+		if(timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+		{
+			return errno;
+		}
+
+		while(read(timer_fd, &expirations, sizeof(expirations)) < 0)
+		{
+			if(errno != EINTR)
+			{
+				return errno;
+			}
+		}
+
+		return 0;
+	}
+
+	/* a signal can cut the sleep short - the deadline is absolute, so just go back to sleep */
+	while((ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL)) == EINTR);
+
+	return ret;
+}
+
+void timebase_virtual_estop_at(const int64_t ns)
+{
+	virtual_estop_ns = ns;
+}
+
+_Bool timebase_virtual_estop(void)
+{
+	return virtual_estop_ns >= 0 && (((int64_t)virtual_now.tv_sec * NSEC_PER_SEC) + virtual_now.tv_nsec) >= virtual_estop_ns;
+}
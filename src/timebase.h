@@ -0,0 +1,55 @@
+/*
+*	timebase.h
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * TIMEBASE
+ * The pulse loop reads the clock and sleeps until each edge through these calls. Normally that is CLOCK_MONOTONIC and
+ * an absolute clock_nanosleep(). A thread can switch itself to a virtual clock instead: sleeping then just moves the
+ * clock to the deadline, and nothing is written to or read from the GPIO. The move runs through exactly the same
+ * state machine and pulse loop, only as fast as the CPU allows - this is how moves are estimated offline (see estimate.c).
+ *
+ * On the real clock, a thread can also sleep on a timerfd of its own instead (-N): the deadline is armed as an absolute
+ * CLOCK_MONOTONIC expiry and the thread blocks in read(). Some RT kernels wake timerfd waiters with less latency, and a
+ * deadline task (see rt_sched.h) behaves the same either way - measure both with -b or -I on the target.
+ **/
+
+/* switches the calling thread to a virtual clock that starts at 0. there is no way back */
+void timebase_use_virtual(void);
+
+/* 1 if the calling thread runs on the virtual clock */
+_Bool timebase_virtual(void);
+
+/* switches the calling thread's sleeps to a timerfd. returns 0 on success, -1 on failure (printed) */
+int8_t timebase_use_timerfd(void);
+
+/* 1 if the calling thread sleeps on a timerfd */
+_Bool timebase_timerfd(void);
+
+/* the current time. returns 0 on success, -1 on failure like clock_gettime() */
+int timebase_now(struct timespec *ts);
+
+/* sleeps until the absolute time deadline. signals don't cut the sleep short. returns 0 on success, an error number on failure */
+int timebase_sleep_until(const struct timespec *deadline);
+
+/**
+ * SIMULATED E-STOP
+ * On a virtual clock the e-stop input reads low until ns nanoseconds after the clock started, and high from then on.
+ * A negative ns (the default) never trips it. Lets an e-stop in the middle of a move be replayed exactly.
+ **/
+void timebase_virtual_estop_at(const int64_t ns);
+
+/* the simulated e-stop input of the calling thread, 1 if tripped */
+_Bool timebase_virtual_estop(void);
+
+#endif /*TIMEBASE_H*/
@@ -0,0 +1,260 @@
+/*
+*	trace.c
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#include "trace.h"
+#include "globals.h"
+#include "timebase.h"
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+static int trace_fd = -1;
+static uint8_t *map = NULL;
+static size_t map_size = 0;
+static struct trace_header *hdr = NULL;
+static uint8_t *cur = NULL;
+static uint8_t *end = NULL;
+static int64_t last_ns = 0;
+
+/* span records from the RT setup, before trace_init(). only held between trace_setup_begin() and trace_init()/trace_setup_end() */
+static _Bool holding = false;
+static struct
+{
+	uint8_t tag;
+	uint8_t span;
+	int64_t ns;
+} pending[TRACE_PENDING_MAX];
+static int32_t pending_count = 0;
+
+static inline int64_t _ts_ns(const struct timespec *t)
+{
+	return ((int64_t)t->tv_sec * NSEC_PER_SEC) + t->tv_nsec;
+}
+
+/* reserves room for one record. once the file is full, records are counted as dropped instead */
+static inline _Bool _reserve(void)
+{
+	if(cur + TRACE_MAX_RECORD > end)
+	{
+		hdr->dropped++;
+		return false;
+	}
+
+	return true;
+}
+
+int8_t trace_init(const char *path, const uint32_t size_mb)
+{
+	map_size = sizeof(struct trace_header) + ((size_t)size_mb * 1024 * 1024);
+
+	if((trace_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+	{
+		perror("\nERROR: Could not open trace file");
+		return -1;
+	}
+
+	/* allocate the blocks up front so the pulse loop never waits on the filesystem */
+	if(posix_fallocate(trace_fd, 0, map_size) != 0)
+	{
+		fprintf(stderr, "\nERROR: Could not preallocate %u MB for the trace file\n", size_mb);
+		close(trace_fd);
+		trace_fd = -1;
+		return -1;
+	}
+
+	/* MAP_POPULATE prefaults the whole file. mlockall(MCL_FUTURE) in rt_setup() then keeps it resident */
+	map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, trace_fd, 0);
+
+	if(map == MAP_FAILED)
+	{
+		perror("\nERROR: Could not map trace file");
+		close(trace_fd);
+		trace_fd = -1;
+		map = NULL;
+		return -1;
+	}
+
+	struct timespec now;
+	timebase_now(&now);
+
+	hdr = (struct trace_header *)map;
+	memcpy(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic));
+	hdr->version = TRACE_VERSION;
+	hdr->header_size = sizeof(struct trace_header);
+	hdr->start_ns = (pending_count > 0) ? pending[0].ns : _ts_ns(&now);
+	hdr->capacity = map_size - sizeof(struct trace_header);
+	hdr->used_bytes = 0;
+	hdr->dropped = 0;
+
+	cur = map + sizeof(struct trace_header);
+	end = map + map_size;
+	last_ns = hdr->start_ns;
+
+	for(int32_t i = 0; i < pending_count; i++)
+	{
+		*cur++ = pending[i].tag;
+		cur = trace_put_varint(cur, trace_zigzag(pending[i].ns - last_ns));
+		cur = trace_put_varint(cur, pending[i].span);
+		last_ns = pending[i].ns;
+	}
+
+	pending_count = 0;
+	holding = false;
+
+	atexit(trace_close);
+
+	return 0;
+}
+
+_Bool trace_active(void)
+{
+	return map != NULL;
+}
+
+void trace_edge(const int8_t level, const struct timespec *t, const int64_t late_ns)
+{
+	if(map == NULL || _reserve() == false)
+	{
+		return;
+	}
+
+	int64_t ns = _ts_ns(t);
+
+	*cur++ = (level != 0) ? TRACE_TAG_EDGE_HIGH : TRACE_TAG_EDGE_LOW;
+	cur = trace_put_varint(cur, trace_zigzag(ns - last_ns));
+	cur = trace_put_varint(cur, trace_zigzag(late_ns));
+	last_ns = ns;
+}
+
+void trace_state(const int32_t state)
+{
+	if(map == NULL || _reserve() == false)
+	{
+		return;
+	}
+
+	struct timespec now;
+	timebase_now(&now);
+	int64_t ns = _ts_ns(&now);
+
+	*cur++ = TRACE_TAG_STATE;
+	cur = trace_put_varint(cur, trace_zigzag(ns - last_ns));
+	cur = trace_put_varint(cur, (uint64_t)state);
+	last_ns = ns;
+}
+
+void trace_direction(const int8_t level)
+{
+	if(map == NULL || _reserve() == false)
+	{
+		return;
+	}
+
+	struct timespec now;
+	timebase_now(&now);
+	int64_t ns = _ts_ns(&now);
+
+	*cur++ = TRACE_TAG_DIRECTION;
+	cur = trace_put_varint(cur, trace_zigzag(ns - last_ns));
+	cur = trace_put_varint(cur, (level != 0) ? 1 : 0);
+	last_ns = ns;
+}
+
+void trace_setup_begin(void)
+{
+	pending_count = 0;
+	holding = true;
+}
+
+void trace_setup_end(void)
+{
+	pending_count = 0;
+	holding = false;
+}
+
+static void _span(const uint8_t tag, const enum trace_span span)
+{
+	if(map == NULL && holding == false)
+	{
+		return;
+	}
+
+	struct timespec now;
+	timebase_now(&now);
+	int64_t ns = _ts_ns(&now);
+
+	if(map == NULL)
+	{
+		if(pending_count < TRACE_PENDING_MAX)
+		{
+			pending[pending_count].tag = tag;
+			pending[pending_count].span = (uint8_t)span;
+			pending[pending_count].ns = ns;
+			pending_count++;
+		}
+
+		return;
+	}
+
+	if(_reserve() == false)
+	{
+		return;
+	}
+
+	*cur++ = tag;
+	cur = trace_put_varint(cur, trace_zigzag(ns - last_ns));
+	cur = trace_put_varint(cur, (uint64_t)span);
+	last_ns = ns;
+}
+
+void trace_span_begin(const enum trace_span span)
+{
+	_span(TRACE_TAG_SPAN_BEGIN, span);
+}
+
+void trace_span_end(const enum trace_span span)
+{
+	_span(TRACE_TAG_SPAN_END, span);
+}
+
+void trace_close(void)
+{
+	if(map == NULL)
+	{
+		return;
+	}
+
+	hdr->used_bytes = (uint64_t)(cur - (map + sizeof(struct trace_header)));
+	size_t used = sizeof(struct trace_header) + hdr->used_bytes;
+
+	if(hdr->dropped > 0)
+	{
+		fprintf(stderr, "\nWARNING: Trace file full, %" PRIu64 " records dropped\n", hdr->dropped);
+	}
+
+	msync(map, map_size, MS_SYNC);
+	munmap(map, map_size);
+
+	/* keep one zero byte past the records as the end tag */
+	if(ftruncate(trace_fd, used + 1) < 0)
+	{
+		perror("\nERROR: Could not truncate trace file");
+	}
+
+	close(trace_fd);
+
+	map = NULL;
+	hdr = NULL;
+	trace_fd = -1;
+}
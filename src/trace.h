@@ -0,0 +1,212 @@
+/*
+*	trace.h
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * BINARY MOTION TRACE
+ * A full fidelity record of a move - every edge and every state transition - written into a preallocated, memory mapped file (see -b).
+ * Nothing is formatted on the device. Use the rhubarb_trace tool (trace_convert.c) to turn a trace into CSV or Chrome/Perfetto JSON.
+ *
+ * File layout:
+ * struct trace_header, followed by a stream of records. Each record is a one byte tag followed by varints:
+ *
+ *	TRACE_TAG_EDGE_HIGH / TRACE_TAG_EDGE_LOW:	zigzag(delta_ns) zigzag(late_ns)
+ *	TRACE_TAG_STATE:							zigzag(delta_ns) state (enum state_codes)
+ *	TRACE_TAG_SPAN_BEGIN / TRACE_TAG_SPAN_END:	zigzag(delta_ns) span (enum trace_span)
+ *	TRACE_TAG_DIRECTION:						zigzag(delta_ns) level of the direction output (1 is CW)
+ *
+ * delta_ns is the time since the previous record (the first record is relative to header.start_ns).
+ * Edge times are the scheduled edge times, late_ns is how late the pulse loop woke up for that edge.
+ * A direction record is written every time the direction output is set, so the steps after it go that way.
+ * The unused part of the file is zero filled, so a TRACE_TAG_END (0) byte or header.used_bytes ends the stream.
+ *
+ * Spans mark where the wall time of a run goes outside the edges themselves: the RT setup steps, planning, and each
+ * call into the pulse loop. Spans of the RT setup, between trace_setup_begin() and trace_init(), are held back and written
+ * first, and header.start_ns is then the start of the earliest one.
+ **/
+
+#define TRACE_MAGIC "RHBTRACE"
+#define TRACE_VERSION 3
+
+/* the oldest version the offline tools still read - version 1 had no spans, version 2 no direction records */
+#define TRACE_VERSION_MIN 1
+
+#define TRACE_TAG_END 0
+#define TRACE_TAG_EDGE_HIGH 1
+#define TRACE_TAG_EDGE_LOW 2
+#define TRACE_TAG_STATE 3
+#define TRACE_TAG_SPAN_BEGIN 4
+#define TRACE_TAG_SPAN_END 5
+#define TRACE_TAG_DIRECTION 6
+
+/* spans can't nest more deeply than this before trace_init() */
+#define TRACE_PENDING_MAX 16
+
+enum trace_span {trace_span_rt_scheduler, trace_span_rt_mlock, trace_span_rt_stack, trace_span_plan, trace_span_pulse, trace_span_move};
+
+/* indexed by enum trace_span */
+static const char *const TRACE_SPAN_NAMES[] = {"rt: scheduler", "rt: mlockall", "rt: prefault stack", "plan", "pulse loop", "move"};
+
+/* the largest record: a tag and two 64 bit varints */
+#define TRACE_MAX_RECORD 21
+
+struct trace_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint64_t start_ns;		/* CLOCK_MONOTONIC, or the virtual clock of a simulated move (see timebase.h) */
+	uint64_t capacity;		/* record bytes available after the header */
+	uint64_t used_bytes;	/* record bytes written, filled in by trace_close() */
+	uint64_t dropped;		/* records that did not fit */
+};
+
+/* creates and maps a trace file of size_mb megabytes. returns 0 on success, -1 on failure. the file is finalized at exit */
+int8_t trace_init(const char *path, const uint32_t size_mb);
+
+/* 1 if trace_init() succeeded */
+_Bool trace_active(void);
+
+/* writer side - return immediately if tracing is not active */
+void trace_edge(const int8_t level, const struct timespec *t, const int64_t late_ns);
+void trace_state(const int32_t state);
+void trace_direction(const int8_t level);
+
+/* return immediately if tracing is not active, unless the RT setup is being held for trace_init() */
+void trace_span_begin(const enum trace_span span);
+void trace_span_end(const enum trace_span span);
+
+/**
+ * Brackets the RT setup of a run that may open a trace later: spans from trace_setup_begin() on are held until trace_init()
+ * writes them, or trace_setup_end() drops them once it is clear there will be no trace. Single threaded - call both before
+ * any other thread starts
+ **/
+void trace_setup_begin(void);
+void trace_setup_end(void);
+
+/* writes the final record count into the header and truncates the file to what was used */
+void trace_close(void);
+
+/* varint helpers, shared with the converter */
+static inline uint64_t trace_zigzag(const int64_t v)
+{
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t trace_unzigzag(const uint64_t v)
+{
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static inline uint8_t *trace_put_varint(uint8_t *p, uint64_t v)
+{
+	while(v >= 0x80)
+	{
+		*p++ = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+
+	*p++ = (uint8_t)v;
+	return p;
+}
+
+/* returns NULL if the varint runs past end */
+static inline const uint8_t *trace_get_varint(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+	uint64_t r = 0;
+	uint8_t shift = 0;
+
+	while(p < end && shift < 64)
+	{
+		uint8_t b = *p++;
+		r |= (uint64_t)(b & 0x7f) << shift;
+
+		if((b & 0x80) == 0)
+		{
+			*v = r;
+			return p;
+		}
+
+		shift += 7;
+	}
+
+	return NULL;
+}
+
+/* one decoded record, shared with the offline tools */
+struct trace_record
+{
+	uint8_t tag;
+	int64_t ns;			/* relative to header.start_ns */
+	int64_t late_ns;	/* edges only */
+	uint64_t state;		/* TRACE_TAG_STATE only */
+	uint64_t span;		/* TRACE_TAG_SPAN_BEGIN/END only */
+	uint64_t direction;	/* TRACE_TAG_DIRECTION only */
+};
+
+/**
+ * Decodes the record at *p and moves *p past it. *ns carries the running time between calls, start it at 0.
+ * Returns 1 for a record, 0 at the end of the stream, -1 on a corrupt record.
+ **/
+static inline int8_t trace_next_record(const uint8_t **p, const uint8_t *end, int64_t *ns, struct trace_record *r)
+{
+	uint64_t delta;
+	uint64_t v;
+
+	if(*p >= end || **p == TRACE_TAG_END)
+	{
+		return 0;
+	}
+
+	r->tag = *(*p)++;
+
+	if((*p = trace_get_varint(*p, end, &delta)) == NULL || (*p = trace_get_varint(*p, end, &v)) == NULL)
+	{
+		return -1;
+	}
+
+	*ns += trace_unzigzag(delta);
+	r->ns = *ns;
+	r->late_ns = 0;
+	r->state = 0;
+	r->span = 0;
+	r->direction = 0;
+
+	switch(r->tag)
+	{
+		case TRACE_TAG_EDGE_HIGH:
+		case TRACE_TAG_EDGE_LOW:
+			r->late_ns = trace_unzigzag(v);
+			break;
+
+		case TRACE_TAG_STATE:
+			r->state = v;
+			break;
+
+		case TRACE_TAG_SPAN_BEGIN:
+		case TRACE_TAG_SPAN_END:
+			r->span = v;
+			break;
+
+		case TRACE_TAG_DIRECTION:
+			r->direction = v;
+			break;
+
+		default:
+			return -1;
+	}
+
+	return 1;
+}
+
+#endif /*TRACE_H*/
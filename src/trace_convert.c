@@ -0,0 +1,279 @@
+/*
+*	trace_convert.c
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*	Offline converter for the binary traces written with -b. Runs on any machine, no wiringPi needed.
+*	Compile with:
+*	gcc -Wall trace_convert.c -o rhubarb_trace
+*
+*/
+
+#include "trace.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+/* indexed by enum state_codes (motion_control.h) */
+static const char *STATE_NAMES[] = {"start", "accel", "run", "decel", "e-stop", "exit with success", "exit with fail"};
+
+enum output_format {csv, json};
+
+static void show_usage(void);
+static const char *state_name(const uint64_t state);
+static const char *span_name(const uint64_t span);
+static void write_csv(FILE *out, const uint8_t *p, const uint8_t *end);
+static void write_json(FILE *out, const uint8_t *p, const uint8_t *end);
+
+int main(int argc, char *argv[])
+{
+	enum output_format format;
+	FILE *out = stdout;
+
+	if(argc < 3 || argc > 4)
+	{
+		show_usage();
+		return EXIT_FAILURE;
+	}
+
+	if(strcmp(argv[2], "csv") == 0)
+	{
+		format = csv;
+	}
+	else if(strcmp(argv[2], "json") == 0)
+	{
+		format = json;
+	}
+	else
+	{
+		show_usage();
+		return EXIT_FAILURE;
+	}
+
+	int fd = open(argv[1], O_RDONLY);
+	struct stat st;
+
+	if(fd < 0 || fstat(fd, &st) < 0)
+	{
+		perror("\nERROR: Could not open trace");
+		return EXIT_FAILURE;
+	}
+
+	if((size_t)st.st_size < sizeof(struct trace_header))
+	{
+		fprintf(stderr, "\nERROR: %s is too short to be a trace\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	const uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if(map == MAP_FAILED)
+	{
+		perror("\nERROR: Could not map trace");
+		return EXIT_FAILURE;
+	}
+
+	const struct trace_header *hdr = (const struct trace_header *)map;
+
+	if(memcmp(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic)) != 0 || hdr->version < TRACE_VERSION_MIN || hdr->version > TRACE_VERSION)
+	{
+		fprintf(stderr, "\nERROR: %s is not a version %d to %d rhubarb_motion trace\n", argv[1], TRACE_VERSION_MIN, TRACE_VERSION);
+		return EXIT_FAILURE;
+	}
+
+	/* a trace from a run that never reached trace_close() has used_bytes == 0 - fall back on the zero end tag */
+	const uint8_t *p = map + hdr->header_size;
+	const uint8_t *end = map + st.st_size;
+
+	if(hdr->used_bytes > 0 && hdr->header_size + hdr->used_bytes <= (uint64_t)st.st_size)
+	{
+		end = p + hdr->used_bytes;
+	}
+
+	if(hdr->dropped > 0)
+	{
+		fprintf(stderr, "WARNING: %" PRIu64 " records were dropped when the trace file filled up\n", hdr->dropped);
+	}
+
+	if(argc == 4 && (out = fopen(argv[3], "w")) == NULL)
+	{
+		perror("\nERROR: Could not open output file");
+		return EXIT_FAILURE;
+	}
+
+	if(format == csv)
+	{
+		write_csv(out, p, end);
+	}
+	else
+	{
+		write_json(out, p, end);
+	}
+
+	if(out != stdout)
+	{
+		fclose(out);
+	}
+
+	munmap((void *)map, st.st_size);
+	return EXIT_SUCCESS;
+}
+
+static const char *state_name(const uint64_t state)
+{
+	if(state < sizeof(STATE_NAMES) / sizeof(STATE_NAMES[0]))
+	{
+		return STATE_NAMES[state];
+	}
+
+	return "unknown";
+}
+
+static const char *span_name(const uint64_t span)
+{
+	if(span < sizeof(TRACE_SPAN_NAMES) / sizeof(TRACE_SPAN_NAMES[0]))
+	{
+		return TRACE_SPAN_NAMES[span];
+	}
+
+	return "unknown";
+}
+
+static void write_csv(FILE *out, const uint8_t *p, const uint8_t *end)
+{
+	struct trace_record r;
+	int64_t ns = 0;
+	int64_t pos = 0;
+	int8_t ret;
+
+	/* steps before the first direction record - and every step of a trace from before version 3 - count as CW */
+	int8_t dir = 1;
+
+	fprintf(out, "time_s,event,value,late_ns,position\n");
+
+	while((ret = trace_next_record(&p, end, &ns, &r)) == 1)
+	{
+		if(r.tag == TRACE_TAG_STATE)
+		{
+			fprintf(out, "%.9f,state,%s,,%" PRId64 "\n", (double)r.ns / 1e9, state_name(r.state), pos);
+			continue;
+		}
+
+		if(r.tag == TRACE_TAG_SPAN_BEGIN || r.tag == TRACE_TAG_SPAN_END)
+		{
+			fprintf(out, "%.9f,%s,%s,,%" PRId64 "\n", (double)r.ns / 1e9, (r.tag == TRACE_TAG_SPAN_BEGIN) ? "begin" : "end", span_name(r.span), pos);
+			continue;
+		}
+
+		if(r.tag == TRACE_TAG_DIRECTION)
+		{
+			dir = (r.direction != 0) ? 1 : -1;
+			fprintf(out, "%.9f,direction,%s,,%" PRId64 "\n", (double)r.ns / 1e9, (dir > 0) ? "CW" : "CCW", pos);
+			continue;
+		}
+
+		if(r.tag == TRACE_TAG_EDGE_HIGH)
+		{
+			pos += dir;
+		}
+
+		fprintf(out, "%.9f,edge,%d,%" PRId64 ",%" PRId64 "\n", (double)r.ns / 1e9, r.tag == TRACE_TAG_EDGE_HIGH, r.late_ns, pos);
+	}
+
+	if(ret < 0)
+	{
+		fprintf(stderr, "WARNING: corrupt record, output truncated\n");
+	}
+}
+
+/**
+ * Chrome trace event format - loads in chrome://tracing and ui.perfetto.dev
+ * States are complete ("X") spans, the pulse level, direction, position and wakeup lateness are counters ("C").
+ * The RT setup, planning, moves and pulse loop calls are begin/end ("B"/"E") spans on a track of their own.
+ **/
+static void write_json(FILE *out, const uint8_t *p, const uint8_t *end)
+{
+	struct trace_record r;
+	int64_t ns = 0;
+	int64_t pos = 0;
+	int8_t dir = 1;
+	int8_t ret;
+
+	int64_t state_start_ns = -1;
+	uint64_t state = 0;
+
+	fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"rhubarb_motion\"}}");
+	fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"states\"}}");
+	fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"edges\"}}");
+	fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":3,\"args\":{\"name\":\"spans\"}}");
+
+	while((ret = trace_next_record(&p, end, &ns, &r)) == 1)
+	{
+		if(r.tag == TRACE_TAG_STATE)
+		{
+			if(state_start_ns >= 0)
+			{
+				fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}", state_name(state), state_start_ns / 1e3, (r.ns - state_start_ns) / 1e3);
+			}
+
+			state = r.state;
+			state_start_ns = r.ns;
+			continue;
+		}
+
+		if(r.tag == TRACE_TAG_SPAN_BEGIN || r.tag == TRACE_TAG_SPAN_END)
+		{
+			fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"%s\",\"pid\":1,\"tid\":3,\"ts\":%.3f}", span_name(r.span), (r.tag == TRACE_TAG_SPAN_BEGIN) ? "B" : "E", r.ns / 1e3);
+			continue;
+		}
+
+		if(r.tag == TRACE_TAG_DIRECTION)
+		{
+			dir = (r.direction != 0) ? 1 : -1;
+			fprintf(out, ",\n{\"name\":\"direction\",\"ph\":\"C\",\"pid\":1,\"tid\":2,\"ts\":%.3f,\"args\":{\"cw\":%d}}", r.ns / 1e3, dir > 0);
+			continue;
+		}
+
+		if(r.tag == TRACE_TAG_EDGE_HIGH)
+		{
+			pos += dir;
+			fprintf(out, ",\n{\"name\":\"position\",\"ph\":\"C\",\"pid\":1,\"tid\":2,\"ts\":%.3f,\"args\":{\"steps\":%" PRId64 "}}", r.ns / 1e3, pos);
+		}
+
+		fprintf(out, ",\n{\"name\":\"pulse\",\"ph\":\"C\",\"pid\":1,\"tid\":2,\"ts\":%.3f,\"args\":{\"level\":%d}}", r.ns / 1e3, r.tag == TRACE_TAG_EDGE_HIGH);
+		fprintf(out, ",\n{\"name\":\"late_us\",\"ph\":\"C\",\"pid\":1,\"tid\":2,\"ts\":%.3f,\"args\":{\"late\":%.3f}}", r.ns / 1e3, r.late_ns / 1e3);
+	}
+
+	/* close the last state at the last record */
+	if(state_start_ns >= 0)
+	{
+		fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}", state_name(state), state_start_ns / 1e3, (ns - state_start_ns) / 1e3);
+	}
+
+	fprintf(out, "\n]}\n");
+
+	if(ret < 0)
+	{
+		fprintf(stderr, "WARNING: corrupt record, output truncated\n");
+	}
+}
+
+static void show_usage(void)
+{
+	printf("\n");
+	printf("rhubarb_trace - converts a rhubarb_motion binary trace (-b)\n");
+	printf("\n");
+	printf("Usage: rhubarb_trace <trace file> <csv|json> [output file]\n");
+	printf("csv: one row per edge, state change, direction change and span begin/end\n");
+	printf("json: Chrome trace event format, for chrome://tracing or ui.perfetto.dev\n");
+	printf("\n");
+}
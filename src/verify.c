@@ -0,0 +1,608 @@
+/*
+*	verify.c
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*	Step timing verifier. Compares the edges of a move - recorded on the device with -b, or simulated here on a
+*	virtual clock (see timebase.h) - against the closed form position vs time curve of the planned trapezoid.
+*	The edge timeline can also be saved as a golden file (-W) and later runs compared against it (-G), edge by edge.
+*	Exits with failure if the timing error is over the tolerance, so it can gate changes to the ramp engine.
+*
+*/
+
+#include "motion_control.h"
+#include "pulse_train.h"
+#include "planner.h"
+#include "trace.h"
+#include "timebase.h"
+#include "globals.h"
+
+#include <unistd.h>
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+enum phase {phase_accel, phase_run, phase_decel};
+static const char *PHASE_NAMES[] = {"accel", "run", "decel"};
+
+struct phase_error
+{
+	int64_t steps;
+	double max_hz;		/* largest step frequency error */
+	double sum_sq_hz;	/* for the RMS */
+};
+
+struct edge
+{
+	int64_t ns;		/* relative to the first edge */
+	int8_t level;
+};
+
+static void show_usage(void);
+static int8_t simulate(struct move_params *mp, const int32_t freq, const int64_t estop_ns, const char *path);
+static int64_t load_edges(const char *path, struct edge **edges);
+static int8_t write_golden(const char *path, const struct edge *edges, const int64_t n);
+static int8_t compare_golden(const char *path, const struct edge *edges, const int64_t n, const double tolerance_us);
+static double ideal_time(const struct move_plan *plan, const double x);
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	struct move_params mp = init_move_params();
+	char trace_path[PATH_MAX] = {0};
+	char golden_path[PATH_MAX] = {0};
+	char write_path[PATH_MAX] = {0};
+	double tolerance_us = 100;
+	int32_t freq = 0;
+	int64_t estop_ns = -1;
+
+	while((opt = getopt(argc, argv, "hs:a:d:v:n:r:b:t:p:E:G:W:")) != -1)
+	{
+		switch(opt)
+		{
+			case 's':
+				mp.starting_speed = atoi(optarg);
+				break;
+
+			case 'a':
+				mp.acc = atoi(optarg);
+				break;
+
+			case 'd':
+				mp.dec = atoi(optarg);
+				break;
+
+			case 'v':
+				mp.velocity = atof(optarg);
+				break;
+
+			case 'n':
+				mp.num_steps = atoll(optarg);
+				mp.CW = (mp.num_steps >= 0);
+				mp.CCW = (mp.num_steps < 0);
+				break;
+
+			case 'r':
+				mp.steps_per_rev = atoi(optarg);
+				break;
+
+			case 'b':
+				strncpy(trace_path, optarg, sizeof(trace_path) - 1);
+				break;
+
+			case 't':
+				tolerance_us = atof(optarg);
+				break;
+
+			case 'p':
+				freq = atoi(optarg);
+				break;
+
+			case 'E':
+				estop_ns = (int64_t)(atof(optarg) * NSEC_PER_MSEC);
+				break;
+
+			case 'G':
+				strncpy(golden_path, optarg, sizeof(golden_path) - 1);
+				break;
+
+			case 'W':
+				strncpy(write_path, optarg, sizeof(write_path) - 1);
+				break;
+
+			default:
+				show_usage();
+				return EXIT_FAILURE;
+		}
+	}
+
+	/* a pulse train only needs a frequency and a step count */
+	if(freq > 0 && mp.num_steps > 0)
+	{
+		mp.starting_speed = freq;
+		mp.velocity = freq;
+		mp.acc = 1;
+		mp.dec = 1;
+	}
+
+	if(mp.starting_speed <= 0 || mp.acc <= 0 || mp.dec <= 0 || mp.velocity <= 0 || mp.velocity < mp.starting_speed || mp.num_steps == 0 || mp.num_steps == -1 || tolerance_us <= 0)
+	{
+		show_usage();
+		return EXIT_FAILURE;
+	}
+
+	/* the reference is the exact constant acceleration trapezoid - for a pulse train, a trapezoid that is all run */
+	struct move_plan plan;
+
+	if(plan_move(&mp, &plan) != 0)
+	{
+		fprintf(stderr, "\nERROR: Could not plan move\n");
+		return EXIT_FAILURE;
+	}
+
+	_Bool simulated = (trace_path[0] == 0);
+
+	if(simulated == true)
+	{
+		strncpy(trace_path, "/tmp/rhubarb_verify.XXXXXX", sizeof(trace_path) - 1);
+
+		if(simulate(&mp, freq, estop_ns, trace_path) != 0)
+		{
+			return EXIT_FAILURE;
+		}
+	}
+
+	struct edge *all = NULL;
+	int64_t count = load_edges(trace_path, &all);
+
+	if(simulated == true)
+	{
+		unlink(trace_path);
+	}
+
+	if(count < 0)
+	{
+		return EXIT_FAILURE;
+	}
+
+	/* the steps are the rising edges */
+	int64_t *edges = malloc((count + 1) * sizeof(int64_t));
+	int64_t n = 0;
+
+	if(edges == NULL)
+	{
+		fprintf(stderr, "\nERROR: Out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	for(int64_t i = 0; i < count; i++)
+	{
+		if(all[i].level == 1)
+		{
+			edges[n++] = all[i].ns;
+		}
+	}
+
+	/* edge k is step k, which ideally happens when the position reaches k. time is relative to the first edge */
+	double max_err = 0;
+	int64_t max_err_step = 0;
+	struct phase_error phases[3];
+	const double acc_end = ((plan.v_peak * plan.v_peak) - (plan.v_start * plan.v_start)) / (2.0 * plan.acc);
+	const double dec_start = plan.distance - (((plan.v_peak * plan.v_peak) - (plan.v_end * plan.v_end)) / (2.0 * plan.dec));
+
+	memset(phases, 0, sizeof(phases));
+
+	for(int64_t k = 0; k < n && k < plan.distance; k++)
+	{
+		double measured = (edges[k] - edges[0]) / (double)NSEC_PER_SEC;
+		double err = measured - ideal_time(&plan, k);
+
+		if(fabs(err) > fabs(max_err))
+		{
+			max_err = err;
+			max_err_step = k;
+		}
+
+		if(k + 1 < n && k + 1 < plan.distance)
+		{
+			double f_measured = (double)NSEC_PER_SEC / (edges[k + 1] - edges[k]);
+			double f_ideal = 1.0 / (ideal_time(&plan, k + 1) - ideal_time(&plan, k));
+			double f_err = f_measured - f_ideal;
+			double x = k + 0.5;
+			struct phase_error *pe = &phases[(x < acc_end) ? phase_accel : ((x > dec_start) ? phase_decel : phase_run)];
+
+			pe->steps++;
+			pe->sum_sq_hz += f_err * f_err;
+
+			if(fabs(f_err) > fabs(pe->max_hz))
+			{
+				pe->max_hz = f_err;
+			}
+		}
+	}
+
+	double last_measured = (n > 0) ? (edges[n - 1] - edges[0]) / (double)NSEC_PER_SEC : 0;
+	double last_ideal = ideal_time(&plan, (n > 0) ? n - 1 : 0);
+
+	printf("\nSTEP TIMING - %s, %s:\n", (freq > 0) ? "Pulse train" : ((plan.triangle == true) ? "Triangle move" : "Trapezoidal move"), (simulated == true) ? "simulated" : trace_path);
+	printf("Steps (planned/measured):\t%" PRId64 " / %" PRId64 "\n", plan.distance, n);
+	printf("Max timing error (us):\t\t%+.3f at step %" PRId64 "\n", max_err * 1e6, max_err_step);
+
+	for(int8_t i = 0; i < 3; i++)
+	{
+		if(phases[i].steps > 0)
+		{
+			printf("Velocity error, %s (Hz):\t%+.3f max, %.3f rms over %" PRId64 " steps\n", PHASE_NAMES[i], phases[i].max_hz, sqrt(phases[i].sum_sq_hz / phases[i].steps), phases[i].steps);
+		}
+	}
+
+	printf("Time to last step (s):\t\t%.6f (ideal %.6f, error %+.3fus)\n", last_measured, last_ideal, (last_measured - last_ideal) * 1e6);
+	printf("Planned move time (s):\t\t%.6f\n", plan.t_total);
+
+	free(edges);
+
+	int8_t ret = 0;
+
+	if(write_path[0] != 0 && write_golden(write_path, all, count) != 0)
+	{
+		ret = -1;
+	}
+
+	if(golden_path[0] != 0 && compare_golden(golden_path, all, count, tolerance_us) != 0)
+	{
+		ret = -1;
+	}
+
+	free(all);
+
+	/* an e-stop ends the move early on purpose - only the golden timeline can say whether it ended in the right place */
+	if(estop_ns < 0 && n != plan.distance)
+	{
+		printf("\nFAIL: the move made %" PRId64 " steps instead of %" PRId64 "\n", n, plan.distance);
+		return EXIT_FAILURE;
+	}
+
+	if(fabs(max_err) * 1e6 > tolerance_us)
+	{
+		printf("\nFAIL: timing error over the %.3fus tolerance\n", tolerance_us);
+		return EXIT_FAILURE;
+	}
+
+	if(ret != 0)
+	{
+		return EXIT_FAILURE;
+	}
+
+	printf("\nPASS\n");
+	return EXIT_SUCCESS;
+}
+
+/**
+ * runs the move - or a pulse train at freq, if freq > 0 - on a virtual clock with a binary trace, exactly as
+ * rhubarb_motion -q -b would. A non-negative estop_ns trips the simulated e-stop that long after the start
+ **/
+static int8_t simulate(struct move_params *mp, const int32_t freq, const int64_t estop_ns, const char *path)
+{
+	int fd = mkstemp((char *)path);
+
+	if(fd < 0)
+	{
+		perror("\nERROR: Could not create a temporary trace");
+		return -1;
+	}
+
+	close(fd);
+
+	/* at most two records per step */
+	uint32_t size_mb = (uint32_t)((llabs(mp->num_steps) * 2 * TRACE_MAX_RECORD) / (1024 * 1024)) + 1;
+
+	timebase_use_virtual();
+	timebase_virtual_estop_at(estop_ns);
+
+	if(trace_init(path, size_mb) != 0)
+	{
+		unlink(path);
+		return -1;
+	}
+
+	/* the move's own progress messages are not part of the report */
+	fflush(stdout);
+	int saved = dup(STDOUT_FILENO);
+
+	if(saved < 0 || freopen("/dev/null", "w", stdout) == NULL)
+	{
+		perror("\nERROR: Could not set up output");
+		unlink(path);
+		return -1;
+	}
+
+	int ret;
+
+	if(freq > 0)
+	{
+		uint64_t motor_pos = 0;
+
+		pulse_reset_overruns();
+		trace_state(STATE_START);
+		ret = pulse_train(freq, &mp->num_steps, &motor_pos);
+	}
+	else
+	{
+		ret = execute_move(mp);
+	}
+
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+	trace_close();
+
+	/* with an e-stop, the move is meant to fail */
+	if(ret != 0 && estop_ns < 0)
+	{
+		fprintf(stderr, "\nERROR: The simulated move failed\n");
+		unlink(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* reads the edges out of a trace. returns the number of edges, -1 on failure */
+static int64_t load_edges(const char *path, struct edge **edges)
+{
+	FILE *fp = fopen(path, "rb");
+	uint8_t *buf = NULL;
+	long size;
+
+	if(fp == NULL || fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < (long)sizeof(struct trace_header) || fseek(fp, 0, SEEK_SET) != 0)
+	{
+		fprintf(stderr, "\nERROR: Could not read trace %s\n", path);
+		return -1;
+	}
+
+	if((buf = malloc(size)) == NULL || fread(buf, 1, size, fp) != (size_t)size)
+	{
+		fprintf(stderr, "\nERROR: Could not read trace %s\n", path);
+		fclose(fp);
+		free(buf);
+		return -1;
+	}
+
+	fclose(fp);
+
+	const struct trace_header *hdr = (const struct trace_header *)buf;
+
+	if(memcmp(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic)) != 0 || hdr->version < TRACE_VERSION_MIN || hdr->version > TRACE_VERSION)
+	{
+		fprintf(stderr, "\nERROR: %s is not a version %d to %d rhubarb_motion trace\n", path, TRACE_VERSION_MIN, TRACE_VERSION);
+		free(buf);
+		return -1;
+	}
+
+	if(hdr->dropped > 0)
+	{
+		fprintf(stderr, "\nERROR: %s is missing %" PRIu64 " records\n", path, hdr->dropped);
+		free(buf);
+		return -1;
+	}
+
+	const uint8_t *p = buf + hdr->header_size;
+	const uint8_t *end = buf + size;
+	struct trace_record r;
+	int64_t ns = 0;
+	int64_t n = 0;
+	int64_t cap = 1024;
+	int8_t ret;
+
+	if(hdr->used_bytes > 0 && hdr->header_size + hdr->used_bytes <= (uint64_t)size)
+	{
+		end = p + hdr->used_bytes;
+	}
+
+	int64_t first_ns = 0;
+
+	*edges = malloc(cap * sizeof(struct edge));
+
+	while(*edges != NULL && (ret = trace_next_record(&p, end, &ns, &r)) == 1)
+	{
+		if(r.tag != TRACE_TAG_EDGE_HIGH && r.tag != TRACE_TAG_EDGE_LOW)
+		{
+			continue;
+		}
+
+		if(n == 0)
+		{
+			first_ns = r.ns;
+		}
+
+		if(n == cap)
+		{
+			struct edge *grown = realloc(*edges, 2 * cap * sizeof(struct edge));
+
+			if(grown == NULL)
+			{
+				free(*edges);
+				*edges = NULL;
+				break;
+			}
+
+			*edges = grown;
+			cap *= 2;
+		}
+
+		(*edges)[n].ns = r.ns - first_ns;
+		(*edges)[n].level = (r.tag == TRACE_TAG_EDGE_HIGH);
+		n++;
+	}
+
+	free(buf);
+
+	if(*edges == NULL)
+	{
+		fprintf(stderr, "\nERROR: Out of memory reading %s\n", path);
+		return -1;
+	}
+
+	if(ret < 0)
+	{
+		fprintf(stderr, "\nWARNING: corrupt record in %s, only the first %" PRId64 " edges are checked\n", path, n);
+	}
+
+	return n;
+}
+
+/**
+ * GOLDEN TIMELINES
+ * A text file with one edge per line - "level ns", ns relative to the first edge. Lines starting with # are comments.
+ **/
+static int8_t write_golden(const char *path, const struct edge *edges, const int64_t n)
+{
+	FILE *fp = fopen(path, "w");
+
+	if(fp == NULL)
+	{
+		perror("\nERROR: Could not write golden timeline");
+		return -1;
+	}
+
+	fprintf(fp, "# rhubarb_motion golden timeline, %" PRId64 " edges\n", n);
+
+	for(int64_t i = 0; i < n; i++)
+	{
+		fprintf(fp, "%d %" PRId64 "\n", edges[i].level, edges[i].ns);
+	}
+
+	fclose(fp);
+	printf("Golden timeline written:\t%s\n", path);
+	return 0;
+}
+
+/* every edge has to be there, at the same level and within tolerance_us of the golden time */
+static int8_t compare_golden(const char *path, const struct edge *edges, const int64_t n, const double tolerance_us)
+{
+	FILE *fp = fopen(path, "r");
+	char line[128];
+	int64_t i = 0;
+	int64_t max_err = 0;
+	int64_t max_err_edge = 0;
+	int8_t ret = 0;
+
+	if(fp == NULL)
+	{
+		perror("\nERROR: Could not open golden timeline");
+		return -1;
+	}
+
+	while(fgets(line, sizeof(line), fp) != NULL)
+	{
+		int level;
+		int64_t ns;
+
+		if(line[0] == '#' || line[0] == '\n')
+		{
+			continue;
+		}
+
+		if(sscanf(line, "%d %" SCNd64, &level, &ns) != 2)
+		{
+			printf("\nFAIL: %s edge %" PRId64 " can't be read\n", path, i);
+			ret = -1;
+			break;
+		}
+
+		if(i >= n)
+		{
+			i++;
+			continue;
+		}
+
+		if(level != edges[i].level)
+		{
+			printf("\nFAIL: edge %" PRId64 " is %s, the golden timeline has it %s\n", i, (edges[i].level == 1) ? "high" : "low", (level == 1) ? "high" : "low");
+			ret = -1;
+			break;
+		}
+
+		if(llabs(edges[i].ns - ns) > llabs(max_err))
+		{
+			max_err = edges[i].ns - ns;
+			max_err_edge = i;
+		}
+
+		i++;
+	}
+
+	fclose(fp);
+
+	if(ret != 0)
+	{
+		return ret;
+	}
+
+	printf("Golden timeline error (us):\t%+.3f at edge %" PRId64 "\n", max_err / 1e3, max_err_edge);
+
+	if(i != n)
+	{
+		printf("\nFAIL: %" PRId64 " edges, the golden timeline has %" PRId64 "\n", n, i);
+		return -1;
+	}
+
+	if(llabs(max_err) / 1e3 > tolerance_us)
+	{
+		printf("\nFAIL: golden timeline error over the %.3fus tolerance\n", tolerance_us);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * The time at which the ideal trapezoid reaches position x, inverted from
+ * accel: x = v_start*t + acc*t^2/2, run: x = d_acc + v_peak*t, decel: x = d_dec_start + v_peak*t - dec*t^2/2
+ **/
+static double ideal_time(const struct move_plan *plan, const double x)
+{
+	const double v0 = plan->v_start;
+	const double vp = plan->v_peak;
+	const double d_acc = ((vp * vp) - (v0 * v0)) / (2.0 * plan->acc);
+	const double d_dec = ((vp * vp) - (plan->v_end * plan->v_end)) / (2.0 * plan->dec);
+	const double t_acc = (vp - v0) / plan->acc;
+	const double t_run = (plan->distance - d_acc - d_dec) / vp;
+
+	if(x <= d_acc)
+	{
+		return (sqrt((v0 * v0) + (2.0 * plan->acc * x)) - v0) / plan->acc;
+	}
+
+	if(x <= plan->distance - d_dec)
+	{
+		return t_acc + ((x - d_acc) / vp);
+	}
+
+	double into = x - (plan->distance - d_dec);
+	double under = (vp * vp) - (2.0 * plan->dec * into);
+
+	return t_acc + fmax(t_run, 0) + ((vp - sqrt(fmax(under, 0))) / plan->dec);
+}
+
+static void show_usage(void)
+{
+	printf("\n");
+	printf("rhubarb_verify - checks the step timing of a move against the ideal trapezoid\n");
+	printf("\n");
+	printf("Usage: rhubarb_verify -s <speed> -a <acc> -d <dec> -v <velocity> -n <steps> [-b trace] [-t tolerance] [-E ms] [-G golden] [-W golden]\n");
+	printf("       rhubarb_verify -p <frequency> -n <steps> [...]\n");
+	printf("-s -a -d -v -n: the move, as for rhubarb_motion\n");
+	printf("-p: a pulse train at this frequency instead of a move, as for rhubarb_motion -t\n");
+	printf("-b: a trace recorded with rhubarb_motion -b for the same move. Without it the move is simulated on a virtual clock\n");
+	printf("-t: the largest timing error allowed for any step in us (default 100)\n");
+	printf("-E: trips the simulated e-stop this many ms into the move\n");
+	printf("-G: compares every edge against a golden timeline, within the same tolerance\n");
+	printf("-W: writes the edges out as a golden timeline\n");
+	printf("\n");
+	printf("Exits with failure if the move made the wrong number of steps, a step is off by more than the tolerance, or it doesn't match the golden timeline.\n");
+	printf("\n");
+}
@@ -0,0 +1,214 @@
+/*
+*	watchdog.c
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#define _GNU_SOURCE
+
+#include "watchdog.h"
+#include "globals.h"
+#include "timebase.h"
+#include "motion_control.h"
+#include "rt_sched.h"
+
+#include <wiringPi.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+extern int8_t WIRINGPI_PULSE_OUTPUT;
+extern int8_t SCHED_POLICY;
+
+/* the BCM283x GPIO block, as mapped by /dev/gpiomem. GPCLR0 drives the outputs set in it low */
+#define GPIO_BLOCK_SIZE 4096
+#define GPIO_GPCLR0 (0x28 / 4)
+
+static _Bool active = false;
+static int64_t timeout_ns = 0;
+static pthread_t watchdog_thread;
+
+/* the heartbeat - the CLOCK_MONOTONIC deadline the loop will be back by, 0 while disarmed */
+static int64_t expected_ns = 0;
+static _Bool tripped = false;
+static __thread _Bool armed_here = false;
+
+/* the pulse output's clear register and bit, NULL if the GPIO block could not be mapped */
+static volatile uint32_t *gpclr = NULL;
+static uint32_t pulse_bit = 0;
+
+static void *_watchdog(void *arg);
+
+static inline int64_t _now_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((int64_t)now.tv_sec * NSEC_PER_SEC) + now.tv_nsec;
+}
+
+int8_t watchdog_init(const int32_t timeout_us, const int32_t cpu)
+{
+	pthread_attr_t attr;
+	struct sched_param param;
+	cpu_set_t cpus;
+	int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	int core = (cpu < 0) ? ncpu - 1 : cpu;
+	int fd;
+
+	if(core >= ncpu)
+	{
+		fprintf(stderr, "\nERROR: The watchdog core must be between 0 and %d\n", ncpu - 1);
+		return -1;
+	}
+
+	timeout_ns = (int64_t)timeout_us * 1000;
+
+	/* a direct register write still works if the pulse loop was stopped in the middle of a digitalWrite() */
+	if((fd = open("/dev/gpiomem", O_RDWR | O_SYNC | O_CLOEXEC)) >= 0)
+	{
+		void *map = mmap(NULL, GPIO_BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		int gpio = wpiPinToGpio(WIRINGPI_PULSE_OUTPUT);
+
+		close(fd);
+
+		if(map != MAP_FAILED && gpio >= 0)
+		{
+			gpclr = (volatile uint32_t *)map + GPIO_GPCLR0 + (gpio / 32);
+			pulse_bit = 1u << (gpio % 32);
+		}
+	}
+
+	if(gpclr == NULL)
+	{
+		fprintf(stderr, "\nWARNING: Could not map the GPIO registers, the watchdog will clear the pulse output through wiringPi\n");
+	}
+
+	CPU_ZERO(&cpus);
+	CPU_SET(core, &cpus);
+
+	param.sched_priority = WATCHDOG_PRIORITY;
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	pthread_attr_setschedparam(&attr, &param);
+	pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+
+	int err = pthread_create(&watchdog_thread, &attr, &_watchdog, NULL);
+	pthread_attr_destroy(&attr);
+
+	if(err != 0)
+	{
+		fprintf(stderr, "\nERROR: Could not start the watchdog thread: %s\n", strerror(err));
+		return -1;
+	}
+
+	/* keep the pulse loop off the watchdog's core. a deadline task has to be free to run on every core, so it keeps them all */
+	if(ncpu > 1 && SCHED_POLICY == rt_sched_fifo)
+	{
+		CPU_ZERO(&cpus);
+
+		for(int i = 0; i < ncpu; i++)
+		{
+			if(i != core)
+			{
+				CPU_SET(i, &cpus);
+			}
+		}
+
+		if(sched_setaffinity(0, sizeof(cpus), &cpus) != 0)
+		{
+			perror("\nWARNING: Could not move the pulse loop off the watchdog core");
+		}
+	}
+
+	active = true;
+	return 0;
+}
+
+void watchdog_arm(void)
+{
+	if(active == false || timebase_virtual() == true)
+	{
+		return;
+	}
+
+	armed_here = true;
+	__atomic_store_n(&tripped, false, __ATOMIC_RELAXED);
+	__atomic_store_n(&expected_ns, _now_ns(), __ATOMIC_RELEASE);
+}
+
+void watchdog_beat(const struct timespec *deadline)
+{
+	if(armed_here == false)
+	{
+		return;
+	}
+
+	__atomic_store_n(&expected_ns, ((int64_t)deadline->tv_sec * NSEC_PER_SEC) + deadline->tv_nsec, __ATOMIC_RELEASE);
+}
+
+_Bool watchdog_disarm(void)
+{
+	if(armed_here == false)
+	{
+		return false;
+	}
+
+	armed_here = false;
+	__atomic_store_n(&expected_ns, 0, __ATOMIC_RELEASE);
+
+	return __atomic_load_n(&tripped, __ATOMIC_ACQUIRE);
+}
+
+_Bool watchdog_tripped(void)
+{
+	return __atomic_load_n(&tripped, __ATOMIC_RELAXED);
+}
+
+static void *_watchdog(void *arg)
+{
+	struct timespec t;
+	int64_t last_tripped = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	for(;;)
+	{
+		t.tv_nsec += timeout_ns / 4;
+		tsnorm(&t);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+
+		int64_t expected = __atomic_load_n(&expected_ns, __ATOMIC_ACQUIRE);
+		int64_t now = _now_ns();
+
+		/* one trip per missed heartbeat */
+		if(expected == 0 || now - expected <= timeout_ns || expected == last_tripped)
+		{
+			continue;
+		}
+
+		if(gpclr != NULL)
+		{
+			*gpclr = pulse_bit;
+		}
+		else
+		{
+			digitalWrite(WIRINGPI_PULSE_OUTPUT, LOW);
+		}
+
+		__atomic_store_n(&tripped, true, __ATOMIC_RELEASE);
+		last_tripped = expected;
+
+		fprintf(stderr, "\n!!!ERROR: Watchdog - the pulse loop missed its heartbeat by %" PRId64 "us, pulse output forced low!\n", (now - expected) / 1000);
+	}
+
+	return NULL;
+}
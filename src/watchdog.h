@@ -0,0 +1,45 @@
+/*
+*	watchdog.h
+*	rhubarb_motion
+*
+*	Copyright 2017 3ML LLC
+*
+*/
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * PULSE LOOP WATCHDOG
+ * With -X, a watchdog thread on a core of its own (by default the last one) checks on the pulse loop every quarter timeout.
+ * While the loop runs it publishes a heartbeat before every sleep - the deadline it will be back by (see timebase_sleep_until()).
+ * If the loop is not back WATCHDOG_TIMEOUT_US after that deadline - a long preemption, a deadlock, a bug - the watchdog clears
+ * the pulse output itself, with a write to the GPIO clear register rather than through wiringPi, and flags the move:
+ * the pulse loop returns PULSE_ERR_WATCHDOG as soon as it runs again, and the move ends like an e-stop.
+ *
+ * The heartbeat is a deadline rather than a count, so slow moves with long gaps between edges don't need a longer timeout.
+ * Under SCHED_FIFO the pulse loop is kept off the watchdog's core, so a loop that spins can't starve the watchdog.
+ * The watchdog itself runs SCHED_FIFO at WATCHDOG_PRIORITY.
+ **/
+
+#define WATCHDOG_PRIORITY 90
+
+/* starts the watchdog thread. cpu < 0 is the last core. call from the pulse loop thread. returns 0 on success, -1 on failure (printed) */
+int8_t watchdog_init(const int32_t timeout_us, const int32_t cpu);
+
+/* starts watching the calling thread - from now on its sleeps are heartbeats */
+void watchdog_arm(void);
+
+/* the heartbeat: the calling thread will be awake again by deadline. does nothing unless the thread is armed */
+void watchdog_beat(const struct timespec *deadline);
+
+/* stops watching. returns 1 if the watchdog tripped since watchdog_arm() */
+_Bool watchdog_disarm(void);
+
+/* 1 once the watchdog tripped since watchdog_arm(). just a load, for the pulse loop */
+_Bool watchdog_tripped(void);
+
+#endif /*WATCHDOG_H*/
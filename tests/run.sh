@@ -0,0 +1,64 @@
+#!/bin/bash
+
+#	run.sh
+#	rhubarb_motion
+#
+#	Builds rhubarb_verify and checks the simulated step timing of a matrix of moves against the golden timelines
+#	in tests/golden. Every edge has to be there, at the same level and within the tolerance of the golden time.
+#
+#	./run.sh		check every case, exits with failure if any case fails
+#	./run.sh -W		rewrite the golden timelines - only after a timing change that was meant and checked
+#
+#	CFLAGS and LIBS are passed on to gcc, e.g. to build against a wiringPi somewhere else.
+
+TESTS=$(cd "$(dirname "$0")" && pwd)
+SRC="$TESTS/../src"
+GOLDEN="$TESTS/golden"
+VERIFY="$TESTS/rhubarb_verify"
+
+LIBS=${LIBS:-"-lrt -lwiringPi -lm -lbsd -lpthread"}
+
+# name, then the rhubarb_verify move options
+CASES=(
+	"short_triangle		-s 100 -a 20000 -d 20000 -v 20000 -n 200"
+	"long_trapezoid		-s 200 -a 10000 -d 8000 -v 6000 -n 8000"
+	"ccw				-s 200 -a 10000 -d 10000 -v 3000 -n -2000"
+	"pulse_train		-p 2000 -n 1000"
+	"estop_mid_move		-s 200 -a 10000 -d 10000 -v 5000 -n 4000 -E 300"
+	"one_step			-s 100 -a 20000 -d 20000 -v 20000 -n 1"
+	"at_starting_speed	-s 500 -a 1000 -d 1000 -v 500 -n 50"
+)
+
+cd "$SRC" || exit 1
+
+gcc -Wall $CFLAGS globals.c motion_control.c pulse_train.c debounce.c encoder.c telemetry.c trace.c feed_override.c stop_request.c planner.c accel_curve.c plan_cache.c timebase.c position.c homing.c jog.c resonance.c gearing.c perf_counters.c state_machine.c watchdog.c replay.c verify.c -o "$VERIFY" -g $LIBS || exit 1
+
+mode="-G"
+
+if [ "$1" == "-W" ]; then
+	mode="-W"
+	mkdir -p "$GOLDEN"
+fi
+
+failed=0
+
+for c in "${CASES[@]}"; do
+	read -r name args <<< "$c"
+
+	if out=$("$VERIFY" $args $mode "$GOLDEN/$name.golden" 2>&1); then
+		echo "PASS	$name"
+	else
+		echo "FAIL	$name	rhubarb_verify $args"
+		echo "$out"
+		failed=$((failed + 1))
+	fi
+done
+
+rm -f "$VERIFY"
+
+if [ $failed -ne 0 ]; then
+	echo "$failed of ${#CASES[@]} cases failed"
+	exit 1
+fi
+
+echo "all ${#CASES[@]} cases passed"